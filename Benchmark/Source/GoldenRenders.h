@@ -0,0 +1,435 @@
+/*
+  ==============================================================================
+
+    GoldenRenders.h
+
+    Fixed renders of the processor and the DSP classes it is built from, for
+    checking that an optimised build still sounds the same. The references
+    live in Benchmark/Golden and are compared against with --verify-golden,
+    see Main.cpp and run-golden.sh. Cases the original, unoptimised code can
+    render are recorded from it (commit cbddeb2), by building this file against
+    a checkout of it with GOLDEN_BASELINE set; the rest cover features it
+    doesn't have and are recorded from this tree with --record-golden.
+    record-golden.sh makes both from real builds.
+  ==============================================================================
+*/
+
+#pragma once
+
+#ifndef GOLDEN_BASELINE
+ #define GOLDEN_BASELINE 0      // Set by Baseline.jucer, which builds only the cases the original code can render
+#endif
+
+#include <JuceHeader.h>
+#include "../../Source/PluginProcessor.h"
+#include "../../Source/MultiDelay.h"
+#include "../../Source/DelayLine.h"
+
+#include <cmath>
+#include <functional>
+#include <limits>
+
+namespace GoldenRenders
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int numChannels = 2;
+    constexpr double bitExact = -std::numeric_limits<double>::infinity();  // Tolerance of a render that must match sample for sample
+    constexpr double baselineDrift = -60.0;    // BandPassCoefficientCache stays within 0.01 dB of the original per-sample designs, about -60 dB
+
+   #if GOLDEN_BASELINE
+    enum class StorageFormat { float32 };       // The original DelayLine only stores floats
+    using GoldenDelayLine = DelayLine;
+    using GoldenMultiDelay = MultiDelay;
+   #else
+    using GoldenDelayLine = DelayLine<>;
+    using GoldenMultiDelay = MultiDelay<>;
+   #endif
+
+
+    /**
+        One render and how close a later build has to come to it.
+        toleranceDb is the largest error allowed, in dB relative to the reference's peak. Renders that go
+        through BiquadBank or SimdFloat get a small tolerance, as their sums are ordered by the SIMD width
+        the build was compiled for; the scalar paths must stay bitExact.
+        fromBaseline marks the cases recorded from the original code. --record-golden leaves their
+        references alone, and their tolerance is baselineDrift wherever a filter is involved.
+    */
+    struct GoldenCase
+    {
+        juce::String name;
+        double toleranceDb = bitExact;
+        bool fromBaseline = false;
+        std::function<juce::AudioBuffer<float>()> render;
+    };
+
+
+    /** Sets a processor parameter to a real value, the way a host automating it would. */
+    inline void setParameter(juce::AudioProcessor& processor, const juce::String& parameterID, float value)
+    {
+        for (auto* param : processor.getParameters())
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(param))
+                if (ranged->paramID == parameterID)
+                    ranged->setValueNotifyingHost(ranged->convertTo0to1(value));
+    }
+
+
+    //==============================================================================
+    /** Stimuli, the same on every channel apart from the noise, which is seeded per channel. */
+    enum class Stimulus { impulses, sweep, noise };
+
+    inline juce::AudioBuffer<float> makeStimulus(Stimulus stimulus, double seconds, int channels = numChannels)
+    {
+        const int numSamples = int(seconds * sampleRate);
+        juce::AudioBuffer<float> buffer(channels, numSamples);
+        buffer.clear();
+
+        for (int channel = 0; channel < channels; channel++)
+        {
+            juce::Random random(channel + 1);
+            float* data = buffer.getWritePointer(channel);
+
+            for (int i = 0; i < numSamples; i++)
+            {
+                if (stimulus == Stimulus::impulses)
+                {
+                    data[i] = i % int(sampleRate / 4) == 0 ? 0.8f : 0.0f;                           // Four clicks a second
+                }
+                else if (stimulus == Stimulus::sweep)
+                {
+                    const double t = i / sampleRate;                                                 // Exponential sweep, 20 Hz to 20 kHz over the buffer
+                    const double rate = std::log(1000.0) / seconds;
+                    data[i] = float(0.5 * std::sin(2.0 * juce::MathConstants<double>::pi * 20.0 * (std::exp(rate * t) - 1.0) / rate));
+                }
+                else
+                {
+                    data[i] = (random.nextFloat() * 2.0f - 1.0f) * 0.25f;                           // -12 dBFS white noise
+                }
+            }
+        }
+
+        return buffer;
+    }
+
+
+    //==============================================================================
+    /**
+        DelayLine::process() a sample at a time, impulses through a fixed delay with feedback.
+        @param format: Sample format of the buffer
+        @param delayTime: Delay in samples. The original DelayLine truncated it to whole samples
+    */
+    inline juce::AudioBuffer<float> renderDelayLineImpulses(StorageFormat format, float delayTime)
+    {
+        auto input = makeStimulus(Stimulus::impulses, 1.0, 1);
+        juce::AudioBuffer<float> output(1, input.getNumSamples());
+
+        GoldenDelayLine line;
+       #if GOLDEN_BASELINE
+        juce::ignoreUnused(format);
+        line.setMaxSizeInSamples(4096);
+       #else
+        line.setMaxSizeInSamples(4096, format);
+       #endif
+        line.setDelayTimeInSamples(delayTime);
+        line.setFeedback(0.6f);
+
+        for (int i = 0; i < input.getNumSamples(); i++)
+            output.setSample(0, i, line.process(input.getSample(0, i)));
+
+        return output;
+    }
+
+
+   #if ! GOLDEN_BASELINE
+    /**
+        DelayLine::processBlock() in random block sizes, jumping to a random delay time every block.
+        The buffer is only just longer than the longest delay, so the read head and its interpolation
+        taps wrap round the end of the buffer over and over, mid-glide and mid-block.
+    */
+    inline juce::AudioBuffer<float> renderDelayLineRandomSweep(StorageFormat format)
+    {
+        auto input = makeStimulus(Stimulus::noise, 2.0);
+        juce::AudioBuffer<float> output(numChannels, input.getNumSamples());
+        std::vector<float> frames(size_t(512 * numChannels));
+
+        DelayLine<> line;
+        line.setMaxSizeInSamples(2040, format, numChannels);       // Rounded up to 2048 frames
+        line.setDelayRamp(64, 0.5f);
+        line.setFeedback(0.5f);
+
+        juce::Random random(42);
+        for (int start = 0; start < input.getNumSamples();)
+        {
+            const int numToDo = juce::jmin(1 + random.nextInt(511), input.getNumSamples() - start);
+            line.setDelayTimeInSamples(1.0f + random.nextFloat() * 2038.0f);
+
+            const float* inputs[numChannels] = { input.getReadPointer(0, start), input.getReadPointer(1, start) };
+            line.processBlock(inputs, frames.data(), numToDo, numChannels, 1);
+
+            for (int channel = 0; channel < numChannels; channel++)
+                for (int i = 0; i < numToDo; i++)
+                    output.setSample(channel, start + i, frames[size_t(i * numChannels + channel)]);
+
+            start += numToDo;
+        }
+
+        return output;
+    }
+   #endif
+
+
+    /** MultiDelay::delaySumAudioVectors() a sample at a time on a sweep, for one filter type. */
+    inline juce::AudioBuffer<float> renderMultiDelayPerSample(int filterType)
+    {
+        auto input = makeStimulus(Stimulus::sweep, 1.0, 1);
+        juce::AudioBuffer<float> output(1, input.getNumSamples());
+
+        auto multiDelay = std::make_unique<GoldenMultiDelay>();
+       #if GOLDEN_BASELINE
+        multiDelay->delaySetup(float(sampleRate));
+       #else
+        multiDelay->delaySetup(float(sampleRate), 1, 1.0f);
+       #endif
+        multiDelay->delayAssignValue(0.4f, 0.02f);
+
+        for (int i = 0; i < input.getNumSamples(); i++)
+            output.setSample(0, i, multiDelay->delaySumAudioVectors(input.getSample(0, i), filterType, 2.0));
+
+        return output;
+    }
+
+
+   #if ! GOLDEN_BASELINE
+    /** MultiDelay::processBlock() on noise while the delay length, feedback and Q move every block. */
+    inline juce::AudioBuffer<float> renderMultiDelayAutomated()
+    {
+        auto input = makeStimulus(Stimulus::noise, 2.0);
+        juce::AudioBuffer<float> output(numChannels, input.getNumSamples());
+        constexpr int blockSize = 256;
+
+        auto multiDelay = std::make_unique<MultiDelay<>>();
+        multiDelay->delaySetup(float(sampleRate), blockSize, 1.0f, numChannels);
+
+        for (int start = 0; start < input.getNumSamples(); start += blockSize)
+        {
+            const float progress = float(start) / float(input.getNumSamples());
+            multiDelay->delayAssignValue(0.4f + 0.4f * progress, 0.01f + 0.03f * progress);
+            multiDelay->setFilter(int(progress * 3.0f), 0.5f + 8.0f * progress);
+
+            const float* inputs[numChannels] = { input.getReadPointer(0, start), input.getReadPointer(1, start) };
+            float* outputs[numChannels] = { output.getWritePointer(0, start), output.getWritePointer(1, start) };
+            multiDelay->processBlock(inputs, outputs, juce::jmin(blockSize, input.getNumSamples() - start));
+        }
+
+        return output;
+    }
+   #endif
+
+
+    /**
+        The whole processor on a stimulus, with parameters changed by automate(time) before every block.
+        @param stimulus: Input
+        @param seconds: Length of the render
+        @param automate: Sets parameters for the block starting at time, in seconds. Everything it leaves
+                         alone stays at its default, apart from recLoop, mix1 and outputGain set here
+    */
+    inline juce::AudioBuffer<float> renderProcessor(Stimulus stimulus, double seconds, std::function<void(juce::AudioProcessor&, double)> automate)
+    {
+        constexpr int blockSize = 512;
+        auto buffer = makeStimulus(stimulus, seconds);
+
+        AudioProg_assignment3AudioProcessor processor;
+        processor.setPlayConfigDetails(numChannels, numChannels, sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+        setParameter(processor, "recLoop", 1.0f);
+        setParameter(processor, "mix1", 0.5f);
+        setParameter(processor, "outputGain", 1.0f);
+
+        juce::MidiBuffer midi;
+        for (int start = 0; start < buffer.getNumSamples(); start += blockSize)
+        {
+            automate(processor, start / sampleRate);
+
+            const int numToDo = juce::jmin(blockSize, buffer.getNumSamples() - start);
+            juce::AudioBuffer<float> block(buffer.getArrayOfWritePointers(), numChannels, start, numToDo);     // Processed in place
+            processor.processBlock(block, midi);
+        }
+
+        processor.releaseResources();
+        return buffer;
+    }
+
+
+    //==============================================================================
+    /**
+        Every render, in a fixed order. The names are the reference file names.
+        The original code has no fractional delays, storage formats, block processing or glides,
+        so only whole-sample delays, MultiDelay a sample at a time and the processor with fixed
+        parameters can be compared with it. Automating the processor, recLoop and delayToggle included,
+        would only measure the glides and smoothing added since, so those renders are recorded from
+        this tree. Built with
+        GOLDEN_BASELINE, only the cases from the original code are listed.
+    */
+    inline juce::Array<GoldenCase> getCases()
+    {
+        juce::Array<GoldenCase> cases;
+        const juce::StringArray formatNames { "f32", "f16", "i16" };
+        const juce::StringArray filterNames { "bass", "wide", "high" };
+
+        cases.add({ "delayline-impulses-whole", bitExact, true, [] { return renderDelayLineImpulses(StorageFormat::float32, 1000.0f); } });
+
+       #if ! GOLDEN_BASELINE
+        for (int format = 0; format < formatNames.size(); format++)
+        {
+            cases.add({ "delayline-impulses-" + formatNames[format], bitExact, false, [format] { return renderDelayLineImpulses(StorageFormat(format), 1000.37f); } });
+            cases.add({ "delayline-random-sweep-" + formatNames[format], bitExact, false, [format] { return renderDelayLineRandomSweep(StorageFormat(format)); } });
+        }
+       #endif
+
+        for (int filterType = 0; filterType < filterNames.size(); filterType++)
+            cases.add({ "multidelay-per-sample-" + filterNames[filterType], baselineDrift, true, [filterType] { return renderMultiDelayPerSample(filterType); } });
+
+       #if ! GOLDEN_BASELINE
+        cases.add({ "multidelay-automated", -100.0, false, [] { return renderMultiDelayAutomated(); } });
+       #endif
+
+        for (int filterType = 0; filterType < filterNames.size(); filterType++)
+        {
+            cases.add({ "processor-sweep-" + filterNames[filterType], baselineDrift, true, [filterType]
+            {
+                return renderProcessor(Stimulus::sweep, 2.0, [filterType](juce::AudioProcessor& processor, double)
+                {
+                    setParameter(processor, "filterType", float(filterType));
+                });
+            } });
+        }
+
+       #if ! GOLDEN_BASELINE
+        cases.add({ "processor-rec-loop", -100.0, false, []                                         // The loop only takes the input while recLoop is on, and plays on without it
+        {
+            return renderProcessor(Stimulus::impulses, 3.0, [](juce::AudioProcessor& processor, double time)
+            {
+                setParameter(processor, "delayFeedback", 0.6f);
+                setParameter(processor, "recLoop", time < 1.0 || time >= 2.0 ? 1.0f : 0.0f);
+            });
+        } });
+
+        cases.add({ "processor-clear", -100.0, false, []                                            // Only switching delayToggle on clears, holding it on doesn't clear again
+        {
+            return renderProcessor(Stimulus::impulses, 3.0, [](juce::AudioProcessor& processor, double time)
+            {
+                setParameter(processor, "delayFeedback", 0.8f);
+                setParameter(processor, "delayToggle", (time >= 1.0 && time < 1.6) || (time >= 2.2 && time < 2.25) ? 1.0f : 0.0f);
+            });
+        } });
+
+        cases.add({ "processor-automated", -100.0, false, []                                        // Every control the DSP reads moving at once, filter type changes included
+        {
+            return renderProcessor(Stimulus::noise, 2.0, [](juce::AudioProcessor& processor, double time)
+            {
+                const float progress = float(time / 2.0);
+                setParameter(processor, "delayLength", 0.4f + 0.8f * progress);
+                setParameter(processor, "delayFeedback", 0.2f + 0.5f * progress);
+                setParameter(processor, "filterQ", 0.5f + 8.0f * progress);
+                setParameter(processor, "filterType", float(juce::jmin(2, int(progress * 3.0f))));
+                setParameter(processor, "drive", 0.5f + 10.0f * progress);
+            });
+        } });
+       #endif
+
+        return cases;
+    }
+
+
+    //==============================================================================
+    /** Writes a render as raw 32 bit floats after its channel and sample counts, so it reads back exactly. */
+    inline bool writeReference(const juce::File& file, const juce::AudioBuffer<float>& audio)
+    {
+        file.deleteFile();
+        juce::FileOutputStream stream(file);
+        if (! stream.openedOk())
+            return false;
+
+        stream.writeInt(audio.getNumChannels());
+        stream.writeInt(audio.getNumSamples());
+        for (int channel = 0; channel < audio.getNumChannels(); channel++)
+            for (int i = 0; i < audio.getNumSamples(); i++)
+                stream.writeFloat(audio.getSample(channel, i));
+
+        return stream.getStatus().wasOk();
+    }
+
+
+    /** Reads a file written by writeReference(), returns false if it is missing or cut short. */
+    inline bool readReference(const juce::File& file, juce::AudioBuffer<float>& audio)
+    {
+        juce::FileInputStream stream(file);
+        if (! stream.openedOk())
+            return false;
+
+        const int channels = stream.readInt();
+        const int samples = stream.readInt();
+        if (channels < 1 || samples < 0 || stream.getTotalLength() != 8 + juce::int64(channels) * samples * 4)
+            return false;
+
+        audio.setSize(channels, samples);
+        for (int channel = 0; channel < channels; channel++)
+            for (int i = 0; i < samples; i++)
+                audio.setSample(channel, i, stream.readFloat());
+
+        return true;
+    }
+
+
+    /**
+        Compares a render with its reference.
+        @return One report entry: the largest error, in dB relative to the reference's peak and as a
+                sample count from the start, and whether it is within the case's tolerance
+    */
+    inline juce::var compare(const GoldenCase& goldenCase, const juce::AudioBuffer<float>& rendered, const juce::AudioBuffer<float>& reference)
+    {
+        auto* result = new juce::DynamicObject();
+        result->setProperty("name", goldenCase.name);
+        result->setProperty("tolerance", goldenCase.toleranceDb == bitExact ? juce::var("bit-exact") : juce::var(goldenCase.toleranceDb));
+        result->setProperty("reference", goldenCase.fromBaseline ? "baseline" : "recorded");
+
+        if (rendered.getNumChannels() != reference.getNumChannels() || rendered.getNumSamples() != reference.getNumSamples())
+        {
+            result->setProperty("passed", false);
+            result->setProperty("problem", "length or channel count differs from the reference");
+            return juce::var(result);
+        }
+
+        double maxError = 0.0, peak = 0.0;
+        int firstMismatch = -1, worstSample = -1;
+        for (int channel = 0; channel < reference.getNumChannels(); channel++)
+        {
+            for (int i = 0; i < reference.getNumSamples(); i++)
+            {
+                const float expected = reference.getSample(channel, i);
+                const float actual = rendered.getSample(channel, i);
+                const double error = std::abs(double(actual) - double(expected));
+                peak = juce::jmax(peak, std::abs(double(expected)));
+
+                if (actual != expected && (firstMismatch < 0 || i < firstMismatch))
+                    firstMismatch = i;
+                if (error > maxError || std::isnan(actual))
+                {
+                    maxError = std::isnan(actual) ? std::numeric_limits<double>::infinity() : error;
+                    worstSample = i;
+                }
+            }
+        }
+
+        const double errorDb = maxError == 0.0 ? bitExact : 20.0 * std::log10(maxError / juce::jmax(peak, 1.0e-30));
+        const bool passed = goldenCase.toleranceDb == bitExact ? firstMismatch < 0 : errorDb <= goldenCase.toleranceDb;
+
+        result->setProperty("passed", passed);
+        result->setProperty("maxErrorDb", firstMismatch < 0 ? juce::var("bit-exact") : juce::var(errorDb));
+        if (firstMismatch >= 0)
+        {
+            result->setProperty("firstMismatchSample", firstMismatch);
+            result->setProperty("worstSample", worstSample);
+        }
+        return juce::var(result);
+    }
+}
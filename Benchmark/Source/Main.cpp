@@ -0,0 +1,711 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    Headless benchmark for the plugin processor and the DSP classes it is built from.
+    Runs every target over a matrix of sample rates, block sizes, filter types and
+    automation patterns, and prints one JSON document with the timings of each case,
+    so results can be stored and compared between versions.
+
+    Usage: Benchmark [--quick] [--seconds <s>] [--target <name>]... [--label <text>] [--output <file.json>] [--realtime-checks]
+           Benchmark --record-golden <dir>
+           Benchmark --verify-golden <dir> [--output <file.json>]
+        --quick     48 kHz and 44.1 kHz, blocks of 64 and 512 only
+        --seconds   Audio rendered per case, 2 seconds by default
+        --target    Only run the named targets: processor, multidelay, multirate, delayline, overdrive,
+                    phasor, triosc, sinosc, squareosc, sinoscbank, modulator, lfofilter, pulser
+        --label     Stored in the report, e.g. the version being measured
+        --output    Writes the report to a file instead of stdout
+        --realtime-checks
+                    Reports heap allocations, locks and blocking system calls made while a block
+                    is rendered, see RealtimeChecker.h. The run fails with exit
+                    code 2 if there were any
+        --record-golden
+                    Instead of timing anything, renders the fixed cases in GoldenRenders.h and
+                    stores them in the folder as references. Record them from a trusted build.
+                    Cases recorded from the original code are skipped, they can't be rendered
+                    from this tree. record-golden.sh records both from real builds
+        --verify-golden
+                    Renders the same cases and compares them with the references in the folder,
+                    each to its own tolerance. The run fails with exit code 3 if any case is
+                    outside it, or its reference is missing. run-golden.sh builds the benchmark
+                    and runs this against Benchmark/Golden
+
+    Per case the report holds:
+        nsPerSample         processing time per sample frame, all channels together
+        realTimeFactor      seconds of audio rendered per second of processing, above 1 is faster than real time
+        blockMicroseconds   p50, p99 and max time of one block
+        peakRssKB           peak resident memory of the process so far
+        realtimeViolations  violations found in the case, only with --realtime-checks
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../Source/PluginProcessor.h"
+#include "../../Source/MultiDelay.h"
+#include "../../Source/DelayLine.h"
+#include "../../Source/Effects.h"
+#include "../../Source/Oscillators.h"
+#include "../../Source/ModulationScheduler.h"
+#include "../../Source/RealtimeChecker.h"
+#include "GoldenRenders.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <sys/resource.h>
+#endif
+
+namespace
+{
+    const juce::StringArray allTargets { "processor", "multidelay", "multirate", "delayline", "overdrive", "phasor", "triosc", "sinosc", "squareosc", "sinoscbank", "modulator", "lfofilter", "pulser" };
+    const juce::StringArray automationPatterns { "static", "delayRamp", "qSweep", "filterSwitch", "everything" };
+    constexpr int numChannels = 2;
+
+
+    /** Options read from the command line. */
+    struct Settings
+    {
+        juce::Array<double> sampleRates { 44100.0, 48000.0, 96000.0, 192000.0 };
+        juce::Array<int> blockSizes { 16, 64, 256, 1024, 4096 };
+        juce::StringArray targets = allTargets;
+        double seconds = 2.0;
+        bool realtimeChecks = false;
+        juce::String label;
+        juce::File output;
+        juce::File recordGolden;                // Folder to record the golden renders into, see GoldenRenders.h
+        juce::File verifyGolden;                // Folder of golden renders to compare with
+    };
+
+
+    /** One point of the benchmark matrix. */
+    struct BenchCase
+    {
+        juce::String target;
+        double sampleRate = 48000.0;
+        int blockSize = 512;
+        int filterType = -1;                    // -1 for targets without a filter
+        juce::String automation;
+    };
+
+
+    /**
+        Value of an automation pattern at a point in time, as a 0 to 1 triangle.
+        @param seconds: Time since the start of the case
+        @param period: Length of one up and down sweep in seconds
+    */
+    float triangle(double seconds, double period)
+    {
+        double phase = std::fmod(seconds / period, 1.0);
+        return float(phase < 0.5 ? phase * 2.0 : 2.0 - phase * 2.0);
+    }
+
+
+    /** Peak resident memory of the process in kilobytes, or -1 where the platform can't tell. */
+    juce::int64 getPeakRssKB()
+    {
+       #if JUCE_LINUX || JUCE_BSD
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;                 // Already in kilobytes
+       #elif JUCE_MAC
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024;          // Bytes on macOS
+       #else
+        return -1;
+       #endif
+    }
+
+
+    /** Collects the duration of every block of a case. */
+    class BlockTimer
+    {
+    public:
+
+        void start()                            { startTicks = juce::Time::getHighResolutionTicks(); }
+        void stop()                             { blockSeconds.push_back(juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks)); }
+        void reserve(size_t numBlocks)          { blockSeconds.reserve(numBlocks); }
+
+        /**
+            Summarises the blocks into the fields of the report.
+            @param benchCase: Case the blocks belong to
+            @param numSamples: Sample frames rendered in the timed blocks
+        */
+        juce::var createReport(const BenchCase& benchCase, juce::int64 numSamples) const
+        {
+            std::vector<double> sorted = blockSeconds;
+            std::sort(sorted.begin(), sorted.end());
+
+            double total = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+            auto percentile = [&sorted](double p) { return sorted.empty() ? 0.0 : sorted[size_t(p * (sorted.size() - 1) + 0.5)] * 1.0e6; };
+
+            auto* blockTimes = new juce::DynamicObject();
+            blockTimes->setProperty("p50", percentile(0.5));
+            blockTimes->setProperty("p99", percentile(0.99));
+            blockTimes->setProperty("max", sorted.empty() ? 0.0 : sorted.back() * 1.0e6);
+
+            auto* report = new juce::DynamicObject();
+            report->setProperty("target", benchCase.target);
+            report->setProperty("sampleRate", benchCase.sampleRate);
+            report->setProperty("blockSize", benchCase.blockSize);
+            report->setProperty("filterType", benchCase.filterType >= 0 ? juce::var(benchCase.filterType) : juce::var());
+            report->setProperty("automation", benchCase.automation);
+            report->setProperty("blocks", int(sorted.size()));
+            report->setProperty("nsPerSample", numSamples > 0 ? total * 1.0e9 / double(numSamples) : 0.0);
+            report->setProperty("realTimeFactor", total > 0.0 ? (double(numSamples) / benchCase.sampleRate) / total : 0.0);
+            report->setProperty("blockMicroseconds", juce::var(blockTimes));
+            report->setProperty("peakRssKB", getPeakRssKB());
+            return juce::var(report);
+        }
+
+    private:
+
+        juce::int64 startTicks = 0;
+        std::vector<double> blockSeconds;
+    };
+
+
+    /**
+        Runs one case: renders warm-up blocks, then times seconds worth of blocks.
+        @param benchCase: Case to run
+        @param seconds: Audio to render in the timed part
+        @param render: Called for every block with the block's input and output, this is the timed part
+        @param automate: Called before every block with its start time, outside the timed part
+    */
+    template <typename Render, typename Automate>
+    juce::var runCase(const BenchCase& benchCase, double seconds, Render&& render, Automate&& automate)
+    {
+        juce::AudioBuffer<float> input(numChannels, benchCase.blockSize);
+        juce::AudioBuffer<float> output(numChannels, benchCase.blockSize);
+        juce::Random random(1);
+
+        auto numBlocks = juce::jmax(1, int(seconds * benchCase.sampleRate / benchCase.blockSize));
+        auto numWarmUpBlocks = juce::jmax(1, int(0.1 * benchCase.sampleRate / benchCase.blockSize));
+
+        BlockTimer timer;
+        timer.reserve(size_t(numBlocks));
+
+        for (int block = -numWarmUpBlocks; block < numBlocks; block++)
+        {
+            for (int channel = 0; channel < numChannels; channel++)                 // -12 dBFS white noise
+                for (int sample = 0; sample < benchCase.blockSize; sample++)
+                    input.setSample(channel, sample, (random.nextFloat() * 2.0f - 1.0f) * 0.25f);
+
+            double time = double(block) * benchCase.blockSize / benchCase.sampleRate;
+            automate(juce::jmax(0.0, time));
+
+            RealtimeChecker::ScopedRealtimeSection realtimeSection("benchmark block");     // Every target is held to the audio thread rules
+
+            if (block < 0)
+            {
+                render(input, output);
+                continue;
+            }
+
+            timer.start();
+            render(input, output);
+            timer.stop();
+        }
+
+        return timer.createReport(benchCase, juce::int64(numBlocks) * benchCase.blockSize);
+    }
+
+
+    using GoldenRenders::setParameter;
+
+
+    juce::var runProcessor(const BenchCase& benchCase, double seconds)
+    {
+        AudioProg_assignment3AudioProcessor processor;
+        processor.setPlayConfigDetails(numChannels, numChannels, benchCase.sampleRate, benchCase.blockSize);
+        processor.prepareToPlay(benchCase.sampleRate, benchCase.blockSize);
+
+        setParameter(processor, "mix1", 0.5f);
+        setParameter(processor, "delayFeedback", 0.5f);
+        setParameter(processor, "delayLength", 2.0f);
+        setParameter(processor, "filterType", float(benchCase.filterType));
+
+        juce::MidiBuffer midi;
+        const bool all = benchCase.automation == "everything";
+
+        auto report = runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+            {
+                output.makeCopyOf(input, true);
+                processor.processBlock(output, midi);
+            },
+            [&](double time)
+            {
+                if (all || benchCase.automation == "delayRamp")
+                    setParameter(processor, "delayLength", 0.4f + 7.6f * triangle(time, 4.0));
+                if (all || benchCase.automation == "qSweep")
+                    setParameter(processor, "filterQ", 0.1f + 17.9f * triangle(time, 2.0));
+                if (all || benchCase.automation == "filterSwitch")
+                    setParameter(processor, "filterType", float((benchCase.filterType + int(time * 2.0)) % 3));
+                if (all)
+                {
+                    setParameter(processor, "delayFeedback", 0.01f + 0.89f * triangle(time, 3.0));
+                    setParameter(processor, "drive", 30.0f * triangle(time, 1.0));
+                }
+            });
+
+        processor.releaseResources();
+        return report;
+    }
+
+
+    /** multirate runs the Bass buffers at decimated rates, see MultiDelay::lineDecimation(). */
+    juce::var runMultiDelay(const BenchCase& benchCase, double seconds, bool multirate = false)
+    {
+        auto multiDelay = std::make_unique<MultiDelay<>>();
+        multiDelay->delaySetup(float(benchCase.sampleRate), benchCase.blockSize, 32.0f, numChannels, StorageFormat::float32, multirate);
+
+        float delayLength = 2.0f, feedback = 0.5f, q = 0.5f;
+        int filterType = benchCase.filterType;
+        const bool all = benchCase.automation == "everything";
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+            {
+                multiDelay->delayAssignValue(delayLength, feedback);
+                multiDelay->setFilter(filterType, q);
+                multiDelay->processBlock(input.getArrayOfReadPointers(), output.getArrayOfWritePointers(), input.getNumSamples());
+            },
+            [&](double time)
+            {
+                if (all || benchCase.automation == "delayRamp")
+                    delayLength = 0.4f + 7.6f * triangle(time, 4.0);
+                if (all || benchCase.automation == "qSweep")
+                    q = 0.1f + 17.9f * triangle(time, 2.0);
+                if (all || benchCase.automation == "filterSwitch")
+                    filterType = (benchCase.filterType + int(time * 2.0)) % 3;
+                if (all)
+                    feedback = 0.01f + 0.89f * triangle(time, 3.0);
+            });
+    }
+
+
+    juce::var runDelayLine(const BenchCase& benchCase, double seconds)
+    {
+        DelayLine<> delayLine;
+        delayLine.setMaxSizeInSamples(int(benchCase.sampleRate * 8.0), StorageFormat::float32, numChannels);
+        delayLine.setFeedback(0.5f);
+
+        float delaySeconds = 0.5f;
+        juce::AudioBuffer<float> frames(1, benchCase.blockSize * numChannels);
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+            {
+                delayLine.setDelayTimeInSamples(delaySeconds * float(benchCase.sampleRate));
+                delayLine.processBlock(input.getArrayOfReadPointers(), frames.getWritePointer(0), input.getNumSamples(), numChannels, 1);
+                juce::ignoreUnused(output);
+            },
+            [&](double time)
+            {
+                if (benchCase.automation != "static")
+                    delaySeconds = 0.1f + 7.8f * triangle(time, 4.0);
+            });
+    }
+
+
+    juce::var runOverdrive(const BenchCase& benchCase, double seconds)
+    {
+        Overdrive overdrive;
+        float drive = 0.5f;
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+            {
+                for (int channel = 0; channel < numChannels; channel++)
+                    output.copyFrom(channel, 0, input, channel, 0, input.getNumSamples());
+
+                overdrive.processBlock(output.getArrayOfWritePointers(), numChannels, input.getNumSamples(), drive);
+            },
+            [&](double time)
+            {
+                if (benchCase.automation != "static")
+                    drive = 30.0f * triangle(time, 1.0);
+            });
+    }
+
+
+    /** Runs one of the Oscillators.h classes, one oscillator per channel, a block at a time. */
+    template <typename Oscillator>
+    juce::var runOscillator(const BenchCase& benchCase, double seconds)
+    {
+        Oscillator oscillators[numChannels];
+        SinOsc modulators[2];
+        juce::AudioBuffer<float> modulation(2, benchCase.blockSize);
+        float frequency = 220.0f;
+
+        auto setup = [&](auto& osc)
+        {
+            osc.setSampleRate(float(benchCase.sampleRate));
+            osc.setFrequency(frequency);
+        };
+        for (auto& osc : oscillators)
+            setup(osc);
+        for (auto& osc : modulators)
+            setup(osc);
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>&, juce::AudioBuffer<float>& output)
+            {
+                const int numSamples = output.getNumSamples();
+
+                if constexpr (std::is_same_v<Oscillator, Modulator>)
+                {
+                    modulators[0].renderBlock(modulation.getWritePointer(0), numSamples);
+                    modulators[1].renderBlock(modulation.getWritePointer(1), numSamples);
+                }
+
+                for (int channel = 0; channel < numChannels; channel++)
+                {
+                    if constexpr (std::is_same_v<Oscillator, Modulator>)
+                        oscillators[channel].renderBlock(output.getWritePointer(channel), modulation.getReadPointer(0), modulation.getReadPointer(1), 0.5f, numSamples);
+                    else
+                        oscillators[channel].renderBlock(output.getWritePointer(channel), numSamples);
+                }
+            },
+            [&](double time)
+            {
+                if (benchCase.automation != "static")
+                    for (auto& osc : oscillators)
+                        osc.setFrequency(55.0f + 1705.0f * triangle(time, 1.0));
+            });
+    }
+
+
+    /** SinOscBank rendering one oscillator per channel, to compare with sinosc. */
+    juce::var runSinOscBank(const BenchCase& benchCase, double seconds)
+    {
+        SinOscBank<numChannels> bank;
+        bank.setSampleRate(float(benchCase.sampleRate));
+        for (int channel = 0; channel < numChannels; channel++)
+            bank.setFrequency(channel, 220.0f);
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>&, juce::AudioBuffer<float>& output)
+            {
+                bank.renderBlock(output.getArrayOfWritePointers(), output.getNumSamples());
+            },
+            [&](double time)
+            {
+                if (benchCase.automation != "static")
+                    for (int channel = 0; channel < numChannels; channel++)
+                        bank.setFrequency(channel, 55.0f + 1705.0f * triangle(time, 1.0));
+            });
+    }
+
+
+    /** One LFOFilter per channel, their lfos ticked at control rate by a ModulationScheduler. */
+    juce::var runLFOFilter(const BenchCase& benchCase, double seconds)
+    {
+        LFOFilter filters[numChannels];
+        ModulationScheduler modulation;
+
+        for (auto& filter : filters)
+        {
+            filter.filterSetParams(float(benchCase.sampleRate), 0.5f, modulation.getControlInterval());
+            filter.setSweep(2000.0f, 200.0f, 2.0f);
+            modulation.addModulator([](void* context) { return static_cast<LFOFilter*>(context)->controlTick(); }, &filter);
+        }
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+            {
+                modulation.process(input.getNumSamples(), [&](int offset, int length)
+                {
+                    for (int channel = 0; channel < numChannels; channel++)
+                        for (int sample = offset; sample < offset + length; sample++)
+                            output.setSample(channel, sample, filters[channel].lfoFilter(input.getSample(channel, sample)));
+                });
+            },
+            [&](double time)
+            {
+                if (benchCase.automation != "static")
+                    for (auto& filter : filters)
+                        filter.setSweep(200.0f + 3800.0f * triangle(time, 2.0), 200.0f, 0.5f + 7.5f * triangle(time, 3.0));
+            });
+    }
+
+
+    /** One Pulser per channel, their lfos ticked at control rate by a ModulationScheduler. */
+    juce::var runPulser(const BenchCase& benchCase, double seconds)
+    {
+        Pulser pulsers[numChannels];
+        ModulationScheduler modulation;
+
+        for (auto& pulser : pulsers)
+        {
+            pulser.setSampleRate(float(benchCase.sampleRate), 0.5f, modulation.getControlInterval());
+            modulation.addModulator([](void* context) { return static_cast<Pulser*>(context)->controlTick(); }, &pulser);
+        }
+
+        return runCase(benchCase, seconds,
+            [&](const juce::AudioBuffer<float>&, juce::AudioBuffer<float>& output)
+            {
+                modulation.process(output.getNumSamples(), [&](int offset, int length)
+                {
+                    for (int channel = 0; channel < numChannels; channel++)
+                        for (int sample = offset; sample < offset + length; sample++)
+                            output.setSample(channel, sample, pulsers[channel].process());
+                });
+            },
+            [](double) {});
+    }
+
+
+    juce::var runTarget(const BenchCase& benchCase, double seconds)
+    {
+        if (benchCase.target == "processor")    return runProcessor(benchCase, seconds);
+        if (benchCase.target == "multidelay")   return runMultiDelay(benchCase, seconds);
+        if (benchCase.target == "multirate")    return runMultiDelay(benchCase, seconds, true);
+        if (benchCase.target == "delayline")    return runDelayLine(benchCase, seconds);
+        if (benchCase.target == "overdrive")    return runOverdrive(benchCase, seconds);
+        if (benchCase.target == "phasor")       return runOscillator<Phasor>(benchCase, seconds);
+        if (benchCase.target == "triosc")       return runOscillator<TriOsc>(benchCase, seconds);
+        if (benchCase.target == "sinosc")       return runOscillator<SinOsc>(benchCase, seconds);
+        if (benchCase.target == "squareosc")    return runOscillator<SquareOsc>(benchCase, seconds);
+        if (benchCase.target == "sinoscbank")   return runSinOscBank(benchCase, seconds);
+        if (benchCase.target == "lfofilter")    return runLFOFilter(benchCase, seconds);
+        if (benchCase.target == "pulser")       return runPulser(benchCase, seconds);
+        return runOscillator<Modulator>(benchCase, seconds);
+    }
+
+
+    /** Filter types and automation patterns only matter for the targets that have them. */
+    juce::Array<BenchCase> buildMatrix(const Settings& settings)
+    {
+        juce::Array<BenchCase> matrix;
+
+        for (auto& target : settings.targets)
+        {
+            const bool hasFilter = target == "processor" || target == "multidelay";
+            juce::Array<int> filterTypes;
+            if (hasFilter)
+                filterTypes = { 0, 1, 2 };
+            else if (target == "multirate")
+                filterTypes = { 0 };            // Only the Bass buffers are decimated
+            else
+                filterTypes = { -1 };
+
+            juce::StringArray patterns;
+            if (hasFilter)
+                patterns = automationPatterns;
+            else if (target == "multirate")
+                patterns = { "static", "delayRamp", "qSweep" };
+            else
+                patterns = { "static", "everything" };
+
+            for (auto sampleRate : settings.sampleRates)
+                for (auto blockSize : settings.blockSizes)
+                    for (auto filterType : filterTypes)
+                        for (auto& pattern : patterns)
+                            matrix.add({ target, sampleRate, blockSize, filterType, pattern });
+        }
+
+        return matrix;
+    }
+
+
+    /** Reads the command line, returns false and prints the problem if it can't be used. */
+    bool parseArguments(const juce::StringArray& args, Settings& settings)
+    {
+        juce::StringArray chosenTargets;
+
+        for (int i = 0; i < args.size(); i++)
+        {
+            auto arg = args[i];
+            auto hasValue = i + 1 < args.size();
+
+            if (arg == "--quick")
+            {
+                settings.sampleRates = { 44100.0, 48000.0 };
+                settings.blockSizes = { 64, 512 };
+            }
+            else if (arg == "--seconds" && hasValue)
+            {
+                settings.seconds = juce::jmax(0.01, args[++i].getDoubleValue());
+            }
+            else if (arg == "--target" && hasValue && allTargets.contains(args[i + 1]))
+            {
+                chosenTargets.add(args[++i]);
+            }
+            else if (arg == "--realtime-checks")
+            {
+                settings.realtimeChecks = true;
+            }
+            else if (arg == "--label" && hasValue)
+            {
+                settings.label = args[++i];
+            }
+            else if (arg == "--output" && hasValue)
+            {
+                settings.output = juce::File::getCurrentWorkingDirectory().getChildFile(args[++i]);
+            }
+            else if (arg == "--record-golden" && hasValue)
+            {
+                settings.recordGolden = juce::File::getCurrentWorkingDirectory().getChildFile(args[++i]);
+            }
+            else if (arg == "--verify-golden" && hasValue)
+            {
+                settings.verifyGolden = juce::File::getCurrentWorkingDirectory().getChildFile(args[++i]);
+            }
+            else
+            {
+                std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+                return false;
+            }
+        }
+
+        if (! chosenTargets.isEmpty())
+            settings.targets = chosenTargets;
+
+        return true;
+    }
+
+
+    /**
+        Records or verifies the golden renders, for --record-golden and --verify-golden.
+        @return The exit code: 0 when every case was recorded or matched, 1 if a reference couldn't be written, 3 if a case failed
+    */
+    int runGolden(const Settings& settings)
+    {
+        const bool recording = settings.recordGolden != juce::File();
+        const auto folder = recording ? settings.recordGolden : settings.verifyGolden;
+        if (recording && ! folder.createDirectory().wasOk())
+            return 1;
+
+        juce::Array<juce::var> results;
+        int numFailed = 0;
+
+        for (auto& goldenCase : GoldenRenders::getCases())
+        {
+            if (recording && goldenCase.fromBaseline)
+            {
+                std::cerr << "Skipping " << goldenCase.name << ", its reference comes from the original code" << std::endl;
+                continue;
+            }
+
+            std::cerr << (recording ? "Recording " : "Verifying ") << goldenCase.name << std::endl;
+            const auto rendered = goldenCase.render();
+            const auto file = folder.getChildFile(goldenCase.name + ".f32");
+
+            if (recording)
+            {
+                if (! GoldenRenders::writeReference(file, rendered))
+                {
+                    std::cerr << "Couldn't write " << file.getFullPathName() << std::endl;
+                    return 1;
+                }
+                continue;
+            }
+
+            juce::AudioBuffer<float> reference;
+            juce::var result;
+            if (GoldenRenders::readReference(file, reference))
+            {
+                result = GoldenRenders::compare(goldenCase, rendered, reference);
+            }
+            else
+            {
+                auto* missing = new juce::DynamicObject();
+                missing->setProperty("name", goldenCase.name);
+                missing->setProperty("passed", false);
+                missing->setProperty("problem", "no reference, record one with record-golden.sh");
+                result = juce::var(missing);
+            }
+
+            if (! bool(result["passed"]))
+            {
+                numFailed++;
+                std::cerr << "  FAILED " << juce::JSON::toString(result, true) << std::endl;
+            }
+            results.add(result);
+        }
+
+        if (recording)
+            return 0;
+
+        auto* report = new juce::DynamicObject();
+        report->setProperty("date", juce::Time::getCurrentTime().toISO8601(true));
+        report->setProperty("simdWidth", SimdFloat::width);
+        report->setProperty("failed", numFailed);
+        report->setProperty("cases", results);
+
+        auto json = juce::JSON::toString(juce::var(report));
+        if (settings.output == juce::File())
+            std::cout << json << std::endl;
+        else if (! settings.output.replaceWithText(json))
+            return 1;
+
+        return numFailed > 0 ? 3 : 0;
+    }
+}
+
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;        // The processor's parameters and timer expect a message manager
+
+    Settings settings;
+    juce::StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    if (! parseArguments(args, settings))
+        return 1;
+
+    if (settings.recordGolden != juce::File() || settings.verifyGolden != juce::File())
+        return runGolden(settings);
+
+    RealtimeChecker::setEnabled(settings.realtimeChecks);
+
+    juce::Array<juce::var> results;
+    auto matrix = buildMatrix(settings);
+
+    for (int i = 0; i < matrix.size(); i++)
+    {
+        auto& benchCase = matrix.getReference(i);
+        std::cerr << "[" << (i + 1) << "/" << matrix.size() << "] " << benchCase.target << " " << benchCase.sampleRate << " Hz, "
+                  << benchCase.blockSize << " samples, " << benchCase.automation << std::endl;
+        auto violationsBefore = RealtimeChecker::getNumViolations();
+        auto result = runTarget(benchCase, settings.seconds);
+
+        if (settings.realtimeChecks)
+            result.getDynamicObject()->setProperty("realtimeViolations", RealtimeChecker::getNumViolations() - violationsBefore);
+
+        results.add(result);
+    }
+
+    auto* report = new juce::DynamicObject();
+    report->setProperty("label", settings.label);
+    report->setProperty("date", juce::Time::getCurrentTime().toISO8601(true));
+    report->setProperty("cpu", juce::SystemStats::getCpuModel());
+    report->setProperty("simdWidth", SimdFloat::width);
+    report->setProperty("secondsPerCase", settings.seconds);
+    report->setProperty("realtimeChecks", settings.realtimeChecks);
+    report->setProperty("cases", results);
+
+    auto json = juce::JSON::toString(juce::var(report));
+
+    if (settings.output == juce::File())
+        std::cout << json << std::endl;
+    else if (! settings.output.replaceWithText(json))
+        return 1;
+
+    if (RealtimeChecker::getNumViolations() > 0)         // Each violation was already printed with its stack trace
+    {
+        std::cerr << RealtimeChecker::getNumViolations() << " real-time violations" << std::endl;
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+  ==============================================================================
+
+    RecordBaseline.cpp
+
+    Records the references of the golden cases the original code can render.
+    record-golden.sh copies it into a checkout of that code (commit cbddeb2)
+    and builds it there with Baseline.jucer, so GoldenRenders.h is compiled
+    against the original classes. Every other case is recorded from this tree
+    with Benchmark --record-golden.
+
+    Usage: RecordBaseline <dir>
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "GoldenRenders.h"
+
+#include <iostream>
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;        // The processor's parameters expect a message manager
+
+    if (argc != 2)
+    {
+        std::cerr << "Usage: RecordBaseline <dir>" << std::endl;
+        return 1;
+    }
+
+    const auto folder = juce::File::getCurrentWorkingDirectory().getChildFile(argv[1]);
+    if (! folder.createDirectory().wasOk())
+        return 1;
+
+    for (auto& goldenCase : GoldenRenders::getCases())                                      // Only the cases from the original code, see GOLDEN_BASELINE
+    {
+        std::cerr << "Recording " << goldenCase.name << std::endl;
+        const auto file = folder.getChildFile(goldenCase.name + ".f32");
+
+        if (! GoldenRenders::writeReference(file, goldenCase.render()))
+        {
+            std::cerr << "Couldn't write " << file.getFullPathName() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
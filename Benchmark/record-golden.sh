@@ -0,0 +1,30 @@
+#!/bin/sh
+# Records every reference in Benchmark/Golden from real builds, then checks them with run-golden.sh.
+# The cases the original code can render come from a checkout of it, built with Baseline.jucer and
+# RecordBaseline.cpp; the rest come from this tree, built with Benchmark.jucer. See GoldenRenders.h.
+# Record from a tree you trust, and commit the references only once run-golden.sh passes.
+#     record-golden.sh [<baseline commit>]      cbddeb2, the original code, by default
+# Needs the Projucer, on the PATH or in PROJUCER, to write the makefiles.
+
+set -e
+cd "$(dirname "$(readlink -f "$0")")"
+
+projucer="${PROJUCER:-Projucer}"
+baseline="${1:-cbddeb2}"
+golden="$(pwd)/Golden"
+checkout="$(mktemp -d)"
+trap 'git worktree remove --force "$checkout"' EXIT
+
+git worktree add --detach "$checkout" "$baseline" >&2
+mkdir -p "$checkout/Benchmark/Source"                  # The original code has no benchmark, the recorder is copied in
+cp Baseline.jucer "$checkout/Benchmark/"
+cp Source/RecordBaseline.cpp Source/GoldenRenders.h "$checkout/Benchmark/Source/"
+"$projucer" --resave "$checkout/Benchmark/Baseline.jucer" >&2
+make -C "$checkout/Benchmark/Builds/BaselineLinuxMakefile" CONFIG=Release -j"$(nproc)" >&2
+"$checkout/Benchmark/Builds/BaselineLinuxMakefile/build/RecordBaseline" "$golden"
+
+"$projucer" --resave Benchmark.jucer >&2
+make -C Builds/LinuxMakefile CONFIG=Release -j"$(nproc)" >&2
+Builds/LinuxMakefile/build/Benchmark --record-golden Golden
+
+./run-golden.sh
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Builds the benchmark and checks every golden render against the references in Benchmark/Golden.
+# Run it after every change to the DSP code, e.g. from a git pre-commit hook:
+#     ln -s ../../Benchmark/run-golden.sh .git/hooks/pre-commit
+# Exits with the benchmark's code: 0 when every case matched, 3 when one didn't, see Main.cpp.
+# The Linux makefile comes from Benchmark.jucer: resave it with the Projucer first (Projucer --resave Benchmark.jucer).
+
+set -e
+cd "$(dirname "$(readlink -f "$0")")"       # Follows the hook symlink back to Benchmark/
+
+if [ ! -f Builds/LinuxMakefile/Makefile ]; then
+    echo "No Builds/LinuxMakefile, resave Benchmark.jucer with the Projucer first" >&2
+    exit 1
+fi
+
+if [ -z "$(ls Golden/*.f32 2>/dev/null)" ]; then
+    echo "No references in Golden, record them with record-golden.sh first" >&2
+    exit 1
+fi
+
+make -C Builds/LinuxMakefile CONFIG=Release -j"$(nproc)" >&2
+Builds/LinuxMakefile/build/Benchmark --verify-golden Golden --output golden-report.json
@@ -0,0 +1,449 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    Headless offline renderer: streams audio files through the plugin processor
+    as fast as the machine allows, for re-rendering stems in batch jobs without
+    a DAW. Files are read and written a block at a time, never loaded whole, and
+    several files are rendered at once, each by its own processor instance.
+
+    Usage: Renderer [options] <input file>...
+        --preset <file>     Parameter values to start from: a JSON object of parameter IDs and values,
+                            e.g. { "delayLength": 2.0, "filterType": 1 }, or the parameter XML the plugin
+                            stores in a session
+        --automation <file> Parameter changes over time, a JSON object of parameter IDs, each holding
+                            [seconds, value] points, e.g. { "filterQ": [[0, 0.5], [30, 8.0]] }. Values are
+                            interpolated linearly between points and held before the first and after the last
+        --output-dir <dir>  Where the rendered files go, next to each input by default
+        --suffix <text>     Added to each output's name, "_fx" by default
+        --format <ext>      wav or flac, the input's own format by default
+        --bits <n>          Output bit depth, 24 by default
+        --block-size <n>    Samples handed to processBlock() at once, 4096 by default
+        --tail <seconds>    Silence rendered after each input so the delays can ring out, 0 by default
+        --jobs <n>          Files rendered at once, one per core by default
+        --output <file>     Writes the report to a file instead of stdout
+
+    Values are in each parameter's own units, as the plugin shows them. Delay Storage, Multirate Bass
+    Delays, Multi-core Delays and Drive Oversampling reallocate when they change, so they are only read
+    from the preset; automating them has no effect. The overdrive's latency is compensated, so outputs
+    line up with their inputs.
+
+    The report holds, per file and for the whole batch, the seconds of audio rendered, the wall clock
+    time taken and their ratio as realTimeFactor. The run fails with exit code 1 if any file failed.
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../Source/PluginProcessor.h"
+#include "../../Source/MultiDelay.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+    /** Options read from the command line. */
+    struct Settings
+    {
+        juce::Array<juce::File> inputs;
+        juce::File preset;
+        juce::File automation;
+        juce::File outputFolder;                // Next to each input when left empty
+        juce::File output;
+        juce::String suffix = "_fx";
+        juce::String format;                    // Extension of the output files, the input's own when empty
+        int bitsPerSample = 24;
+        int blockSize = 4096;
+        double tailSeconds = 0.0;
+        int numJobs = juce::SystemStats::getNumCpus();
+    };
+
+
+    /** Sets a processor parameter to a real value, the way a host automating it would. */
+    void setParameter(juce::AudioProcessor& processor, const juce::String& parameterID, float value)
+    {
+        for (auto* param : processor.getParameters())
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(param))
+                if (ranged->paramID == parameterID)
+                    ranged->setValueNotifyingHost(ranged->convertTo0to1(value));
+    }
+
+
+    /** One parameter's automation: points in time order, read with linear interpolation. */
+    struct AutomationLane
+    {
+        juce::String parameterID;
+        juce::Array<juce::Point<double>> points;        // x is seconds, y the value
+
+        float getValueAt(double seconds) const
+        {
+            if (seconds <= points.getFirst().x)
+                return float(points.getFirst().y);
+
+            for (int i = 1; i < points.size(); i++)
+            {
+                const auto& a = points.getReference(i - 1);
+                const auto& b = points.getReference(i);
+                if (seconds < b.x)
+                    return float(a.y + (b.y - a.y) * (seconds - a.x) / juce::jmax(1.0e-9, b.x - a.x));
+            }
+
+            return float(points.getLast().y);
+        }
+    };
+
+
+    /** Everything a render job needs apart from the files, read once and shared read-only by every job. */
+    struct RenderSetup
+    {
+        juce::MemoryBlock presetState;                  // Processor state from an XML preset
+        juce::NamedValueSet presetValues;               // Parameter values from a JSON preset
+        juce::Array<AutomationLane> automation;
+        int blockSize = 4096;
+        double tailSeconds = 0.0;
+        int bitsPerSample = 24;
+    };
+
+
+    /** Outcome of one file. */
+    struct FileResult
+    {
+        juce::File input;
+        juce::File output;
+        bool ok = false;
+        juce::String problem;
+        double audioSeconds = 0.0;
+        double renderSeconds = 0.0;
+    };
+
+
+    constexpr int automationInterval = 256;             // Samples between automation updates, blocks are split to match
+
+
+    /** Reads the preset file into setup, returns false and prints the problem if it can't be used. */
+    bool loadPreset(const juce::File& file, RenderSetup& setup)
+    {
+        if (file.hasFileExtension("xml"))
+        {
+            auto xml = juce::XmlDocument::parse(file);
+            if (xml == nullptr)
+            {
+                std::cerr << "Couldn't parse " << file.getFullPathName() << std::endl;
+                return false;
+            }
+
+            juce::AudioProcessor::copyXmlToBinary(*xml, setup.presetState);
+            return true;
+        }
+
+        auto json = juce::JSON::parse(file);
+        auto* object = json.getDynamicObject();
+        if (object == nullptr)
+        {
+            std::cerr << "Expected a JSON object of parameter values in " << file.getFullPathName() << std::endl;
+            return false;
+        }
+
+        setup.presetValues = object->getProperties();
+        return true;
+    }
+
+
+    /** Reads the automation file into setup, returns false and prints the problem if it can't be used. */
+    bool loadAutomation(const juce::File& file, RenderSetup& setup)
+    {
+        auto json = juce::JSON::parse(file);
+        auto* object = json.getDynamicObject();
+        if (object == nullptr)
+        {
+            std::cerr << "Expected a JSON object of automation lanes in " << file.getFullPathName() << std::endl;
+            return false;
+        }
+
+        for (auto& property : object->getProperties())
+        {
+            AutomationLane lane;
+            lane.parameterID = property.name.toString();
+
+            if (auto* points = property.value.getArray())
+                for (auto& point : *points)
+                    if (point.isArray() && point.size() == 2)
+                        lane.points.add({ double(point[0]), double(point[1]) });
+
+            if (lane.points.isEmpty())
+            {
+                std::cerr << "Automation for " << lane.parameterID << " has no [seconds, value] points" << std::endl;
+                return false;
+            }
+
+            std::sort(lane.points.begin(), lane.points.end(), [](auto& a, auto& b) { return a.x < b.x; });
+            setup.automation.add(lane);
+        }
+
+        return true;
+    }
+
+
+    /**
+        Renders one file through its own processor, a block at a time.
+        The output is as long as the input plus the tail; the overdrive's latency is rendered past the end
+        and dropped from the start.
+    */
+    void renderFile(const RenderSetup& setup, FileResult& result)
+    {
+        const auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+        juce::AudioFormatManager formats;
+        formats.registerBasicFormats();
+
+        std::unique_ptr<juce::AudioFormatReader> reader(formats.createReaderFor(result.input));
+        if (reader == nullptr)
+        {
+            result.problem = "couldn't read the input";
+            return;
+        }
+
+        const int numChannels = int(reader->numChannels);
+        const double sampleRate = reader->sampleRate;
+        if (numChannels < 1 || numChannels > MultiDelay<>::maxChannels)
+        {
+            result.problem = "unsupported channel count " + juce::String(numChannels);
+            return;
+        }
+
+        auto* format = formats.findFormatForFileExtension(result.output.getFileExtension());
+        result.output.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream(result.output.createOutputStream());
+        std::unique_ptr<juce::AudioFormatWriter> writer(format != nullptr && stream != nullptr
+            ? format->createWriterFor(stream.get(), sampleRate, juce::uint32(numChannels), setup.bitsPerSample, {}, 0) : nullptr);
+        if (writer == nullptr)
+        {
+            result.problem = "couldn't create the output";
+            return;
+        }
+        stream.release();                                                                   // Now owned by the writer
+
+        AudioProg_assignment3AudioProcessor processor;
+        processor.setPlayConfigDetails(numChannels, numChannels, sampleRate, setup.blockSize);
+
+        if (setup.presetState.getSize() > 0)
+            processor.setStateInformation(setup.presetState.getData(), int(setup.presetState.getSize()));
+        for (auto& value : setup.presetValues)
+            setParameter(processor, value.name.toString(), float(value.value));
+        for (auto& lane : setup.automation)
+            setParameter(processor, lane.parameterID, lane.getValueAt(0.0));
+
+        processor.prepareToPlay(sampleRate, setup.blockSize);                               // After the preset, so the buffers are allocated as it asks
+
+        const juce::int64 inputLength = juce::int64(reader->lengthInSamples);
+        const juce::int64 outputLength = inputLength + juce::int64(setup.tailSeconds * sampleRate);
+        const int latency = processor.getLatencySamples();
+        const int stepSize = setup.automation.isEmpty() ? setup.blockSize : automationInterval;
+
+        juce::AudioBuffer<float> buffer(numChannels, setup.blockSize);
+        juce::MidiBuffer midi;
+        juce::int64 position = 0;                                                           // Samples rendered so far, latency included
+
+        while (position < outputLength + latency)
+        {
+            const int numToDo = int(juce::jmin(juce::int64(setup.blockSize), outputLength + latency - position));
+            buffer.clear();
+
+            if (position < inputLength)
+                reader->read(&buffer, 0, int(juce::jmin(juce::int64(numToDo), inputLength - position)), position, true, true);
+
+            for (int start = 0; start < numToDo; start += stepSize)
+            {
+                const int numInStep = juce::jmin(stepSize, numToDo - start);
+                for (auto& lane : setup.automation)
+                    setParameter(processor, lane.parameterID, lane.getValueAt(double(position + start) / sampleRate));
+
+                juce::AudioBuffer<float> step(buffer.getArrayOfWritePointers(), numChannels, start, numInStep);   // Processed in place
+                processor.processBlock(step, midi);
+            }
+
+            const int skip = int(juce::jlimit(juce::int64(0), juce::int64(numToDo), juce::int64(latency) - position));   // Latency still to drop
+            if (skip < numToDo && ! writer->writeFromAudioSampleBuffer(buffer, skip, numToDo - skip))
+            {
+                result.problem = "couldn't write the output";
+                return;
+            }
+
+            position += numToDo;
+        }
+
+        processor.releaseResources();
+        writer.reset();                                                                     // Flushes and closes the file
+
+        result.ok = true;
+        result.audioSeconds = double(outputLength) / sampleRate;
+        result.renderSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    }
+
+
+    /** Reads the command line, returns false and prints the problem if it can't be used. */
+    bool parseArguments(const juce::StringArray& args, Settings& settings)
+    {
+        auto cwd = juce::File::getCurrentWorkingDirectory();
+
+        for (int i = 0; i < args.size(); i++)
+        {
+            auto arg = args[i];
+            auto hasValue = i + 1 < args.size();
+
+            if (arg == "--preset" && hasValue)                  settings.preset = cwd.getChildFile(args[++i]);
+            else if (arg == "--automation" && hasValue)         settings.automation = cwd.getChildFile(args[++i]);
+            else if (arg == "--output-dir" && hasValue)         settings.outputFolder = cwd.getChildFile(args[++i]);
+            else if (arg == "--output" && hasValue)             settings.output = cwd.getChildFile(args[++i]);
+            else if (arg == "--suffix" && hasValue)             settings.suffix = args[++i];
+            else if (arg == "--format" && hasValue)             settings.format = args[++i].trimCharactersAtStart(".").toLowerCase();
+            else if (arg == "--bits" && hasValue)               settings.bitsPerSample = args[++i].getIntValue();
+            else if (arg == "--block-size" && hasValue)         settings.blockSize = juce::jmax(1, args[++i].getIntValue());
+            else if (arg == "--tail" && hasValue)               settings.tailSeconds = juce::jmax(0.0, args[++i].getDoubleValue());
+            else if (arg == "--jobs" && hasValue)               settings.numJobs = juce::jmax(1, args[++i].getIntValue());
+            else if (! arg.startsWith("--"))                    settings.inputs.add(cwd.getChildFile(arg));
+            else
+            {
+                std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+                return false;
+            }
+        }
+
+        if (settings.inputs.isEmpty())
+        {
+            std::cerr << "No input files" << std::endl;
+            return false;
+        }
+
+        if (settings.format.isNotEmpty() && settings.format != "wav" && settings.format != "flac")
+        {
+            std::cerr << "Output format must be wav or flac" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /** Where one input's render goes. */
+    juce::File getOutputFile(const Settings& settings, const juce::File& input)
+    {
+        auto folder = settings.outputFolder == juce::File() ? input.getParentDirectory() : settings.outputFolder;
+        auto extension = settings.format.isEmpty() ? input.getFileExtension() : "." + settings.format;
+        return folder.getChildFile(input.getFileNameWithoutExtension() + settings.suffix + extension);
+    }
+
+
+    juce::var createReport(const juce::Array<FileResult>& results, double wallSeconds, int numJobs)
+    {
+        juce::Array<juce::var> files;
+        double totalAudioSeconds = 0.0;
+
+        for (auto& result : results)
+        {
+            auto* file = new juce::DynamicObject();
+            file->setProperty("input", result.input.getFullPathName());
+            file->setProperty("output", result.output.getFullPathName());
+            file->setProperty("ok", result.ok);
+            if (result.ok)
+            {
+                file->setProperty("audioSeconds", result.audioSeconds);
+                file->setProperty("renderSeconds", result.renderSeconds);
+                file->setProperty("realTimeFactor", result.renderSeconds > 0.0 ? result.audioSeconds / result.renderSeconds : 0.0);
+                totalAudioSeconds += result.audioSeconds;
+            }
+            else
+            {
+                file->setProperty("problem", result.problem);
+            }
+            files.add(juce::var(file));
+        }
+
+        auto* report = new juce::DynamicObject();
+        report->setProperty("date", juce::Time::getCurrentTime().toISO8601(true));
+        report->setProperty("cpu", juce::SystemStats::getCpuModel());
+        report->setProperty("jobs", numJobs);
+        report->setProperty("audioSeconds", totalAudioSeconds);
+        report->setProperty("wallSeconds", wallSeconds);
+        report->setProperty("realTimeFactor", wallSeconds > 0.0 ? totalAudioSeconds / wallSeconds : 0.0);   // Of the whole batch, every job together
+        report->setProperty("files", files);
+        return juce::var(report);
+    }
+}
+
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;        // The processor's parameters and timer expect a message manager
+
+    Settings settings;
+    juce::StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add(argv[i]);
+
+    if (! parseArguments(args, settings))
+        return 1;
+
+    RenderSetup setup;
+    setup.blockSize = settings.blockSize;
+    setup.tailSeconds = settings.tailSeconds;
+    setup.bitsPerSample = settings.bitsPerSample;
+
+    if (settings.preset != juce::File() && ! loadPreset(settings.preset, setup))
+        return 1;
+    if (settings.automation != juce::File() && ! loadAutomation(settings.automation, setup))
+        return 1;
+    if (settings.outputFolder != juce::File() && ! settings.outputFolder.createDirectory().wasOk())
+        return 1;
+
+    juce::Array<FileResult> results;
+    for (auto& input : settings.inputs)
+    {
+        FileResult result;
+        result.input = input;
+        result.output = getOutputFile(settings, input);
+        if (result.output == input)
+            result.problem = "output would overwrite the input, set --suffix or --output-dir";
+        results.add(result);
+    }
+
+    const int numJobs = juce::jlimit(1, juce::jmax(1, results.size()), settings.numJobs);
+    const auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+    {
+        juce::ThreadPool pool(numJobs);                     // One processor per job, each file on its own thread
+        for (auto& result : results)
+        {
+            if (result.problem.isNotEmpty())
+                continue;
+
+            pool.addJob([&setup, &result]
+            {
+                renderFile(setup, result);
+                if (result.ok)
+                    std::cerr << "Rendered " << result.input.getFileName() << std::endl;
+                else
+                    std::cerr << "Failed " << result.input.getFileName() << ": " << result.problem << std::endl;
+            });
+        }
+
+        while (pool.getNumJobs() > 0)
+            juce::Thread::sleep(20);
+    }
+
+    const double wallSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    auto json = juce::JSON::toString(createReport(results, wallSeconds, numJobs));
+
+    if (settings.output == juce::File())
+        std::cout << json << std::endl;
+    else if (! settings.output.replaceWithText(json))
+        return 1;
+
+    for (auto& result : results)
+        if (! result.ok)
+            return 1;
+
+    return 0;
+}
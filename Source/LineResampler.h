@@ -0,0 +1,198 @@
+/*
+  ==============================================================================
+
+    LineResampler.h
+
+    Runs a DelayLine at a fraction of the host sample rate, for delay buffers
+    whose band sits far below the host Nyquist.
+  ==============================================================================
+*/
+
+#ifndef LineResampler_h
+#define LineResampler_h
+
+#include <algorithm>
+#include <vector>
+
+/**
+    Decimates a block by factor, runs it through a DelayLine at the lower rate, and interpolates
+    the line's output back up to the host rate.
+
+    The decimator is a second order CIC filter (a triangle of 2 * factor - 1 taps), worked out as
+    two running sums so it costs two multiply-adds per input sample. Its nulls sit on every multiple
+    of the low rate, where aliases would fold down onto the band: at a low rate of 16 times the band
+    centre, anything that aliases onto the band is about 47 dB down, and the passband droops by
+    under 0.2 dB. The output is read back up with Catmull-Rom Hermite interpolation, its weights worked
+    out once per phase so each host sample costs four multiply-adds, and the buffer's band-pass
+    filter after it takes out what is left of the images.
+
+    The buffer, and the line's work per sample, shrink by factor. The round trip adds
+    getLatencyInSamples() on top of the line's delay; feedback stays inside the line, so the
+    repeats that follow keep the line's own spacing.
+*/
+class LineResampler
+{
+public:
+
+    static constexpr int maxChannels = 8;
+    static constexpr int maxFactor = 16;
+    static constexpr int historyFrames = 4;             // Low rate outputs kept from the block before, for the interpolation taps
+
+    /**
+        Allocates the scratch blocks. Never call from the audio thread.
+        @param newFactor: Decimation factor, 1 to leave the line at the host rate, up to maxFactor
+        @param maxBlockSize: Largest block process() will be given, at the host rate
+        @param newNumChannels: Channels the line holds
+    */
+    void setup(int newFactor, int maxBlockSize, int newNumChannels)
+    {
+        factor = std::min(std::max(1, newFactor), maxFactor);
+        numChannels = std::min(std::max(1, newNumChannels), maxChannels);
+        norm = 1.0f / float(factor * factor);
+
+        for (int k = 0; k < factor; k++)                                                        // Triangle weights, and the Catmull-Rom weights of the 4 taps, at each phase, see HermiteInterpolation
+        {
+            fallingWeights[k] = float(factor - 1 - k);
+            risingWeights[k] = float(k + 1);
+
+            const float t = float(k + 1) / float(factor);
+            const float t2 = t * t, t3 = t2 * t;
+            hermiteWeights[k * 4 + 0] = -0.5f * t3 + t2 - 0.5f * t;
+            hermiteWeights[k * 4 + 1] = 1.5f * t3 - 2.5f * t2 + 1.0f;
+            hermiteWeights[k * 4 + 2] = -1.5f * t3 + 2.0f * t2 + 0.5f * t;
+            hermiteWeights[k * 4 + 3] = 0.5f * t3 - 0.5f * t2;
+        }
+
+        lowStride = factor > 1 ? maxBlockSize / factor + 1 : 0;
+        lowIn.assign(size_t(lowStride) * size_t(numChannels), 0.0f);
+        lowOut.assign(size_t(lowStride + historyFrames) * size_t(numChannels), 0.0f);
+        reset();
+    }
+
+
+    /** Decimation factor, 1 when the line runs at the host rate. */
+    int getFactor() const { return factor; }
+
+
+    /** Delay added by decimating and interpolating, in host rate samples. */
+    int getLatencyInSamples() const { return factor > 1 ? 3 * factor : 0; }
+
+
+    /** Forgets the signal so far, call when the line is cleared. */
+    void reset()
+    {
+        phase = 0;
+        std::fill(std::begin(current), std::end(current), 0.0f);
+        std::fill(std::begin(next), std::end(next), 0.0f);
+        std::fill(lowOut.begin(), lowOut.end(), 0.0f);
+    }
+
+
+    /**
+        Processes a block through line at the low rate. Arguments as for DelayLine::processBlock().
+        @param line: DelayLine sized and timed in low rate samples
+    */
+    template <typename Line>
+    void process(Line& line, const float* const* inputs, float* output, int numSamples, int frameStride, int channelStride)
+    {
+        const int startPhase = phase;
+        const int numLow = (startPhase + numSamples) / factor;                                  // Windows the block completes
+        const float* lowInputs[maxChannels];
+
+        for (int channel = 0; channel < numChannels; channel++)                                 // Triangle decimator: each sample ends one output's window and starts the next's
+        {
+            const float* in = inputs[channel];
+            float* low = lowIn.data() + size_t(channel) * size_t(lowStride);
+            float sumCurrent = current[channel];
+            float sumNext = next[channel];
+            int windowPhase = startPhase;
+
+            for (int i = 0, frame = 0; i < numSamples; frame++)
+            {
+                const int numInWindow = std::min(factor - windowPhase, numSamples - i);
+                if (numInWindow == factor && factor % 4 == 0)                                     // Whole window: four partial sums, so the adds don't wait on each other
+                {
+                    float fall[4] = {}, rise[4] = {};
+                    for (int k = 0; k < factor; k += 4)
+                        for (int j = 0; j < 4; j++)
+                        {
+                            fall[j] += fallingWeights[k + j] * in[i + k + j];
+                            rise[j] += risingWeights[k + j] * in[i + k + j];
+                        }
+
+                    sumCurrent += (fall[0] + fall[1]) + (fall[2] + fall[3]);
+                    sumNext += (rise[0] + rise[1]) + (rise[2] + rise[3]);
+                    i += factor;
+                }
+                else
+                {
+                    for (int k = windowPhase; k < windowPhase + numInWindow; k++, i++)
+                    {
+                        sumCurrent += fallingWeights[k] * in[i];
+                        sumNext += risingWeights[k] * in[i];
+                    }
+                }
+
+                windowPhase += numInWindow;
+                if (windowPhase == factor)
+                {
+                    low[frame] = sumCurrent * norm;
+                    sumCurrent = sumNext;
+                    sumNext = 0.0f;
+                    windowPhase = 0;
+                }
+            }
+
+            current[channel] = sumCurrent;
+            next[channel] = sumNext;
+            lowInputs[channel] = low;
+        }
+
+        phase = (startPhase + numSamples) % factor;
+
+        if (numLow > 0)
+            line.processBlock(lowInputs, lowOut.data() + size_t(historyFrames) * size_t(numChannels), numLow, numChannels, 1);
+
+        int i = 0;
+        for (int window = 0; i < numSamples; window++)                                           // Host samples in window w read 3 low samples back, (k + 1) / factor of the way on at phase k
+        {
+            const int firstPhase = window == 0 ? startPhase : 0;
+            const int numInWindow = std::min(factor - firstPhase, numSamples - i);
+
+            for (int channel = 0; channel < numChannels; channel++)
+            {
+                const float* taps = lowOut.data() + size_t(window) * size_t(numChannels) + size_t(channel);
+                const float xm1 = taps[0], x0 = taps[numChannels], x1 = taps[2 * numChannels], x2 = taps[3 * numChannels];
+                float* out = output + i * frameStride + channel * channelStride;
+
+                for (int k = 0; k < numInWindow; k++)
+                {
+                    const float* w = hermiteWeights + (firstPhase + k) * 4;
+                    out[k * frameStride] = w[0] * xm1 + w[1] * x0 + w[2] * x1 + w[3] * x2;
+                }
+            }
+
+            i += numInWindow;
+        }
+
+        std::copy(lowOut.begin() + std::ptrdiff_t(numLow) * numChannels,                        // The newest outputs become the history for the next block
+                  lowOut.begin() + std::ptrdiff_t(numLow + historyFrames) * numChannels, lowOut.begin());
+    }
+
+private:
+
+    int factor = 1;
+    int numChannels = 1;
+    float norm = 1.0f;                                  // 1 / factor^2, the triangle's total weight
+    int phase = 0;                                      // Position in the current decimation window
+    float current[maxChannels] = {};                    // Running sum of the output that ends with this window
+    float next[maxChannels] = {};                       // Running sum of the output that ends with the next window
+    int lowStride = 0;                                  // Most low rate frames a block can give, floats between two channels in lowIn
+    std::vector<float> lowIn;                           // Decimated block, one run of lowStride per channel
+    std::vector<float> lowOut;                          // historyFrames of older outputs, then the block's outputs, interleaved
+    float fallingWeights[maxFactor] = {};              // Weight of an input at each phase in the window that ends with it
+    float risingWeights[maxFactor] = {};               // and in the window after
+    float hermiteWeights[maxFactor * 4] = {};          // Interpolation weights of the 4 taps for each phase of a window
+};
+
+#endif // !LineResampler_h
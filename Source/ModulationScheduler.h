@@ -0,0 +1,149 @@
+/*
+  ==============================================================================
+
+    ModulationScheduler.h
+
+    Runs control-rate modulation, such as smoothers and LFOs, on a fixed grid
+    of control ticks instead of every sample.
+  ==============================================================================
+*/
+
+#ifndef ModulationScheduler_h
+#define ModulationScheduler_h
+
+#include <JuceHeader.h>
+#include <algorithm>
+
+/**
+    Calls a fixed list of modulators once every controlInterval samples and splits blocks at those ticks.
+
+    Ticks are counted from reset() rather than from the start of each block, so a modulator moves on
+    the same samples whatever block sizes the host sends, and its cost depends on the control rate
+    rather than the sample rate. Each modulator is added once, by the object that owns it, and every
+    tick updates them in the order they were added.
+
+    A modulator's tick returns whether it is still moving. Once none of them are, process() stops
+    splitting blocks until wake() is called, typically when a parameter changes; ticks skipped
+    meanwhile would not have changed anything, so the result is the same as ticking throughout.
+*/
+class ModulationScheduler
+{
+public:
+
+    /** A modulator's tick: updates its targets for the next controlInterval samples, returns false once it has settled. */
+    using TickFunction = bool (*)(void* context);
+
+    static constexpr int maxModulators = 16;
+
+    /**
+        Adds a modulator after the ones already added. Never call while process() is running.
+        @param tick: Called at every control tick
+        @param context: Handed to tick, usually the modulator's owner
+    */
+    void addModulator(TickFunction tick, void* context)
+    {
+        jassert(numModulators < maxModulators);
+
+        if (numModulators < maxModulators)
+            modulators[numModulators++] = { tick, context };
+    }
+
+
+    /**
+        Sets the samples between control ticks, taking effect from the next tick.
+        @param samples: Samples between ticks, at least 1
+    */
+    void setControlInterval(int samples)
+    {
+        controlInterval = std::max(1, samples);
+    }
+
+
+    int getControlInterval() const
+    {
+        return controlInterval;
+    }
+
+
+    /** Starts the tick grid again from the next sample, which gets a tick. */
+    void reset()
+    {
+        samplesToNextTick = 0;
+        awake = true;
+    }
+
+
+    /** Makes process() tick again, call when a modulator's target may have moved. */
+    void wake()
+    {
+        awake = true;
+    }
+
+
+    /**
+        Runs a block: ticks the modulators wherever a tick falls and hands the samples in between to render.
+        @param numSamples: Samples in the block
+        @param render: Called as render(startSample, numSamplesInSegment) for each run of samples between ticks
+    */
+    template <typename RenderFunction>
+    void process(int numSamples, RenderFunction&& render)
+    {
+        int start = 0;
+
+        while (start < numSamples)
+        {
+            if (! awake)                                                        // Nothing moving: no splitting, just keep the grid going
+            {
+                const int numLeft = numSamples - start;
+                render(start, numLeft);
+
+                if (numLeft >= samplesToNextTick)
+                    samplesToNextTick = (samplesToNextTick - numLeft) % controlInterval + controlInterval;
+                else
+                    samplesToNextTick -= numLeft;
+
+                samplesToNextTick %= controlInterval;                           // 0 means a tick is due on the next sample
+                return;
+            }
+
+            if (samplesToNextTick == 0)
+            {
+                awake = tick();
+                samplesToNextTick = controlInterval;
+                continue;
+            }
+
+            const int numToDo = std::min(samplesToNextTick, numSamples - start);
+            render(start, numToDo);
+            start += numToDo;
+            samplesToNextTick -= numToDo;
+        }
+    }
+
+private:
+
+    /** Updates every modulator in order, returns true if any of them is still moving. */
+    bool tick()
+    {
+        bool moving = false;
+
+        for (int i = 0; i < numModulators; i++)
+            moving = modulators[i].tick(modulators[i].context) || moving;      // Every modulator ticks, even once one has said it is moving
+
+        return moving;
+    }
+
+    struct Entry
+    {
+        TickFunction tick = nullptr;
+        void* context = nullptr;
+    };
+
+    Entry modulators[maxModulators];
+    int numModulators = 0;
+    int controlInterval = 32;                           // Samples between ticks
+    int samplesToNextTick = 0;                          // 0 when a tick is due before the next sample
+    bool awake = true;                                  // A modulator was still moving at the last tick, or wake() was called
+};
+
+#endif // !ModulationScheduler_h
@@ -12,110 +12,648 @@
 #define MultiDelay_h
 
 #include <JuceHeader.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
 #include <vector>
 #include "DelayLine.h"
 #include "Effects.h"
+#include "FilterCoefficientCache.h"
+#include "BiquadBank.h"
+#include "DelayWorkerPool.h"
+#include "FeedbackMatrix.h"
+#include "LineResampler.h"
+
+/**
+    Per-buffer tables for a MultiDelay of numLines buffers, worked out at compile time.
+    Every table is scaled by 20 / numLines, so 20 buffers give exactly the original values and
+    other counts spread the same range over more or fewer buffers.
+*/
+namespace MultiDelayTables
+{
+    /** Mix gain of each buffer, falling from 0.1 on the first buffer to -0.1 on the last. */
+    template <int numLines>
+    constexpr std::array<float, numLines> makeLineGains()
+    {
+        std::array<float, numLines> gains {};
+        for (int i = 0; i < numLines; i++)
+            gains[i] = float((0.2 * ((numLines / 2.0f) - i)) / numLines);    // Reduces the gain for each subsequent buffer, and divides by the number of buffers to avoid distortion
+        return gains;
+    }
+
+
+    /** Factor applied to the feedback parameter for each buffer. */
+    template <int numLines>
+    constexpr std::array<double, numLines> makeFeedbackScales()
+    {
+        std::array<double, numLines> scales {};
+        for (int i = 0; i < numLines; i++)
+            scales[i] = (i + 0.1) * (20.0 / numLines);
+        return scales;
+    }
+
+
+    /** Factor applied to the delay length parameter for each buffer, the last buffer is twice the parameter. */
+    template <int numLines>
+    constexpr std::array<double, numLines> makeDelayScales()
+    {
+        std::array<double, numLines> scales {};
+        for (int i = 0; i < numLines; i++)
+            scales[i] = (0.1 * (i + 1)) * (20.0 / numLines);
+        return scales;
+    }
+
+
+    /** Centre frequency of each buffer's band-pass filter, for each filter type (Low-Pass, Wide-Band and High-Pass). */
+    template <int numLines>
+    constexpr std::array<std::array<float, numLines>, 3> makeBandFrequencies()
+    {
+        std::array<std::array<float, numLines>, 3> frequencies {};
+        for (int i = 0; i < numLines; i++)
+        {
+            float cutOffIndex = float(i + 1);                                       // Shifts index range from 0-19 to 1-20
+            frequencies[0][i] = 550 - (cutOffIndex * (25 * 20.0f / numLines));      // Low Band Pass filter, applying different low frequency values to each buffer to minimize crowding
+            frequencies[1][i] = 20500 - (cutOffIndex * (20000.0f / numLines));      // Wide Band Pass filter, covers most ferquencies, each buffer has a specific frequency assigned to it.
+            frequencies[2][i] = 10500 - (cutOffIndex * (500 * 20.0f / numLines));   // High Band Pass filter, Covers high frequency bands and each buffer has a specific frequency assigned to it.
+        }
+        return frequencies;
+    }
+}
+
 
     /**
         Class to handle vector operations. 
+        All channels are linked: delay times, feedback and filter coefficients are worked out
+        once and shared by every channel.
+        @tparam numLines: Number of delay buffers, 20 by default
     */
+template <int numLines = 20>
 class MultiDelay
 {
 public:
 
+    static_assert(numLines > 0, "MultiDelay needs at least one buffer");
+    static_assert(numLines <= DelayWorkerPool::maxJobs, "MultiDelay can't have more buffers than a DelayWorkerPool batch has jobs");
+
+    static constexpr int maxChannels = DelayLine<>::maxChannels;                           // Up to 7.1
+    static constexpr int size = numLines;                                                   // Number of delay buffers
+
     /**
          Set sample rate to assign delay buffer length.
          Along with initializing different objects in the class.
          @param Sample Rate
+         @param maxBlockSize: Largest block processBlock() will be handed at once
+         @param maxDelayLengthIn: Largest delayLengthIn that delayAssignValue() will be given, sizes the delay buffers
+         @param numChannelsIn: Number of linked channels, up to maxChannels
+         @param format: Sample format the delay buffers are stored in
+         @param multirateBass: Runs each buffer at the lowest rate its Bass band allows, see lineDecimation(). Only for the Bass filter type
     */
-    void delaySetup(float sr)
+    void delaySetup(float sr, int maxBlockSize, float maxDelayLengthIn, int numChannelsIn = 1, StorageFormat format = StorageFormat::float32, bool multirateBass = false)
     {
+        finishLateLines();                                                                  // A job left running past its deadline may still be using the buffers
+
         sampleRate = sr;
-        size = delayVec.size();                                                             // Stores the size of the delay vector
-                                                                                            
-        smoothfilterFreq.reset(sampleRate, 0.000005);                                       // Sets the sample rate and rampLengthIn seconds                         
-        smoothfilterFreq.setCurrentAndTargetValue(0);                                       // Set new Value to 0
-                                                                                            
-        bufferSize = sampleRate * 20;                                                       // The buffersize variable to set Max delay length
+        blockSize = maxBlockSize;
+        numChannels = juce::jlimit(1, maxChannels, numChannelsIn);
+
+        filterBank.setup(size, numChannels);                                                // One band-pass filter per buffer and channel, processed several at a time
+        stride = filterBank.getStride();
+        groupStride = filterBank.getGroupStride();
+        frameBuffer.assign(blockSize * stride, 0.0f);                                       // Scratch for processBlock(), allocated here so the audio thread never has to
+        spareFrameBuffer.assign(blockSize * stride, 0.0f);                                  // Takes over from frameBuffer when a job overruns its deadline
+        lineJobInputBuffer.assign(blockSize * numChannels, 0.0f);                           // The jobs' own copy of the input
+        quietBefore.assign(blockSize, 0);                                                   // Where the input is quiet, see findQuietInput()
+        nextLoud.assign(blockSize, 0);
+        spareQuietBefore.assign(blockSize, 0);
+        spareNextLoud.assign(blockSize, 0);
+        feedbackBuffer.assign(blockSize * stride, 0.0f);                                    // Mixed outputs fed back in network mode
+        feedbackMixer.setup(size, groupStride);
+
+        lineGains.assign(groupStride, 0.0f);                                                // Padded to whole SIMD registers, the padding lanes stay silent
+        std::copy(lineGainTable.begin(), lineGainTable.end(), lineGains.begin());
+
+        coefficientCache.setup(sampleRate, size);                                           // Designs every band once, so processing only has to look them up
+        for (int type = 0; type < BandPassCoefficientCache::numTypes; type++)
+            for (int i = 0; i < size; i++)
+                coefficientCache.setBand(type, i, lineFilterFrequency(i, type));
+        appliedFilterType = -1;                                                             // Forces the filters to pick up the new coefficients
+        setWorkerPool(workerPool);                                                          // Line count may have changed, so the jobs are split again
+
+        maxDelayLength = maxDelayLengthIn;
+        std::fill(std::begin(lineAsleep), std::end(lineAsleep), false);
+        std::fill(std::begin(lineHeldUntil), std::end(lineHeldUntil), 0);
+        samplePosition = 0;
+        quietRun = maxQuietRun;
+        lineTailsDirty = true;
+        anyLineDecimated = false;
         for (int i = 0; i < size; i++)                                                      // Loop that runs through the delay Vectors        
         {
-            maxDelayLength = bufferSize * (0.2 * (i + 1));
-            delayVec[i]->setMaxSizeInSamples(maxDelayLength);                               // Assigns max delay buffer size to each delay buffer, setting size of 4 seconds on delay[0] to 80 seconds to delay[19] 
+            resamplers[i].setup(lineDecimation(i, multirateBass), blockSize, numChannels);
+            anyLineDecimated = anyLineDecimated || resamplers[i].getFactor() > 1;
+
+            const float lineRate = sampleRate / float(resamplers[i].getFactor());         // Rate the buffer runs at
+            delays[i].setMaxSizeInSamples(requiredBufferSize(i, maxDelayLength), format, numChannels);  // Each buffer only gets the longest delay it can actually reach, 1.6 seconds on delay[0] to 32 seconds on delay[19] with the default parameter range
+            delays[i].setSeamFadeLength(int(lineRate * seamFadeSeconds));                   // Crossfade over the seam of a frozen loop
+            delays[i].setDelayRamp(int(lineRate * delayGlideSeconds), maxDelayGlideStep);   // Delay time changes glide instead of jumping
         }
-            
+
+        if (assignedDelayLength > 0.0f)                                                     // Buffers set up again keep their delay times, in their new rates
+            delayAssignValue(assignedDelayLength, assignedFeedback);
     }                                                                                       
                                                                                             
                                                                                             
     /**                                                                                     
        Function to assign delay length and feedback for each buffer.                        
+       Only call it when a value has changed: each buffer glides to its new delay time on its own, see DelayLine::setDelayRamp().
        @param delayLengthIn: Delay length input parameter                                   
        @param feedbackIn: Delay Feedback input parameter                                    
     */                                                                                      
     void delayAssignValue(float delayLengthIn, float feedbackIn)                            
     {                                                                                       
-                                                                                            
+        assignedDelayLength = delayLengthIn;
+        assignedFeedback = feedbackIn;
+
         for (int i = 0; i < size; i++)                                                      
-        {                                                                                   
-            delayLength = bufferSize * ((0.1 * (i + 1)) * (delayLengthIn/ 40));             // Multiplies BufferSize variable with delayLength input param, max size of delay length is 2 seconds for delay[0] to 40 seonds for delay[19]           
-            feedbackVal = (i + 0.1) * feedbackIn;                                           // Feedback value for each buffer, The feedbackIn parameter value is applied to all buffers.              
-                                                                                            
-            delayVec[i]->setDelayTimeInSamples(delayLength);                                // Sets the delay length for each buffer
-            delayVec[i]->setFeedback(feedbackVal);                                          // Sets feedback for each buffer.   
-        }                                                                                   
+            if (! lineBusy[i])                                                              // A busy buffer picks the values up once its job finishes
+                applyLineValues(i);
                                                                                             
     }                                                                                       
                                                                                             
                                                                                             
+    /**
+        Delay time of one buffer for a delayLength parameter value.
+        @param index: index of buffer in the vector
+        @param delayLengthIn: Delay length input parameter
+    */
+    float delayTimeInSamples(int index, float delayLengthIn) const
+    {
+        return sampleRate * 20 * (delayScaleTable[index] * (delayLengthIn / 40));          // Scales 20 seconds of samples by the delayLength input param, the last buffer is numLines times longer than the first
+    }
+
+
+    /**
+        Sizing policy for the delay buffers: the longest delay a buffer can reach,
+        plus the extra sample linearInterpolation() reads past the read index.
+        @param index: index of buffer in the vector
+        @param maxDelayLengthIn: Largest delayLength parameter value
+    */
+    int requiredBufferSize(int index, float maxDelayLengthIn) const
+    {
+        return int(std::ceil(lineDelayTime(index, delayTimeInSamples(index, maxDelayLengthIn)))) + 2;
+    }
+
+
+    /**
+        Decimation policy for multirate storage: the largest power of two, up to maxDecimation, that keeps
+        the buffer's rate at least minRateToBand times the centre of its Bass band. A Bass band sits
+        between 50 and 525 Hz, so at 48 kHz the buffers run at 1/4 to 1/16 of the host rate, and at
+        192 kHz they all run at 1/16.
+        @param index: index of buffer in the vector
+        @param multirateBass: false keeps every buffer at the host rate
+    */
+    int lineDecimation(int index, bool multirateBass) const
+    {
+        if (! multirateBass)
+            return 1;
+
+        int factor = 1;
+        while (factor * 2 <= maxDecimation && sampleRate / float(factor * 2) >= minRateToBand * bandFrequencyTable[0][index])
+            factor *= 2;
+
+        return factor;
+    }
+
+
     /**                                                                                     
         Void function to clear samples in delay buffers.                                    
+        Only the moment the toggle turns on clears, holding it on costs nothing. The buffers go silent
+        straight away and are zeroed a chunk at a time as they are played, see DelayLine::scheduleClear().
         @param delayToggleVal: Boolean variable to trigger the function.                    
     */                                                                                      
     void clearDelayBuffers(bool delayToggleVal)                                             
     {                                                                                       
-        if (delayToggleVal == true)                                                         // If delayToggleVal is true then clear the buffers.
+        if (delayToggleVal && ! clearToggleHeld)                                            // If delayToggleVal has just turned on then clear the buffers.
         {                                                                                   
             for (int i = 0; i < size; i++)                                                  
             {                                                                               
-                delayVec[i]->clearDelayBuffer();                                            // Calls the clearDelayBuffer() from DelayLine.h for each buffer in the vector. 
+                if (lineBusy[i])                                                            // Cleared once its job finishes
+                {
+                    clearWhenIdle[i] = true;
+                    continue;
+                }
+
+                delays[i].scheduleClear();                                                  // Calls the scheduleClear() from DelayLine.h for each buffer in the vector. 
+                resamplers[i].reset();
             }                                                                               
+            filterBank.reset();                                                             // Stops the filters ringing on after the clear
         }                                                                                   
                                                                                             
+        clearToggleHeld = delayToggleVal;
     }                                                                                       
                                                                                             
                                                                                             
-    /**                                                                                     
-        Applies a filter on individual buffer                                               
-        @param inSample: Input sample                                                       
-        @param index: index of buffer in the vector                                         
-        @param type: Type of filter (Low-Pass, Wide-Band and High-Pass)                     
-    */                                                                                      
-    float delayBufferFilter(float inSample,int index, int type, float qVal)                 
-    {                                                                                       
-                                                                                            
-        float cutOffIndex = index + 1;                                                                                                  // Shifts index range from 0-19 to 1-20
-        switch (type)                                                                                                                   // Switch funtion that uses the type input variable to select a filter type.
-        {                                                                                                                               
-        case 0:                                                                                                                         
-            filterFreq = 550 - (cutOffIndex * 25);                                                                                      // Low Band Pass filter, applying different low frequency values to each buffer to minimize crowding
-            break;                                                                                                                      
-                                                                                                                                        
-        case 1:                                                                                                                         
-            filterFreq = 20500 - (cutOffIndex * (20000 / size));                                                                        // Wide Band Pass filter, covers most ferquencies, each buffer has a specific frequency assigned to it.
-            break;                                                                                                                      
-                                                                                                                                        
-        case 2:                                                                                                                         
-            filterFreq = 10500 - (cutOffIndex * 500);                                                                                   // High Band Pass filter, Covers high frequency bands and each buffer has a specific frequency assigned to it.
-            break;                                                                                                                      
-        }                                                                                                                               
-                                                                                                                                        
-        smoothfilterFreq.setTargetValue(filterFreq);                                                                                    // filterFreq is set as new target value.
-
-        filterVec[index]->setCoefficients(juce::IIRCoefficients::makeBandPass(sampleRate, smoothfilterFreq.getNextValue(), qVal));      // JUCE filter class. Setting sample rate, frequency and Q.
-        filterOut = filterVec[index]->processSingleSampleRaw(inSample);                                                                 // applies respective filter on the input signal.
-                
-        return filterOut;
-    }
- 
+    /**
+        Freezes every buffer: they stop writing and loop what they hold, read-only, until released.
+        Call it every block; freezing and releasing crossfade, see DelayLine::setFrozen().
+        @param shouldFreeze: true while the freeze control is on
+    */
+    void setFreeze(bool shouldFreeze)
+    {
+        for (int i = 0; i < size; i++)
+            if (! lineBusy[i])                                                              // Caught up with on the first block after its job finishes
+                delays[i].setFrozen(shouldFreeze);
+    }
+
+
+    /**
+        Chooses how the buffers feed back. With FeedbackMatrix::none each buffer feeds back into itself;
+        otherwise the buffers run as a feedback delay network, their outputs mixed through the matrix
+        before each is scaled by its own feedback and written back, which thickens the echoes into a
+        reverb-like tail. A network runs single-threaded and never puts buffers to sleep, and while any
+        buffer is frozen or thawing, or runs at a decimated rate, the buffers go back to feeding back into themselves.
+        @param matrix: Mixing matrix for the feedback
+    */
+    void setFeedbackMatrix(FeedbackMatrix matrix)
+    {
+        feedbackMatrix = matrix;
+    }
+
+
+    /**
+        How long the delays keep sounding after the input stops, from the current delay times, feedback and
+        filter type: the time for the slowest buffer's echoes to fall below DelayLine::silenceThreshold at
+        the output, see lineTailInSamples(). Infinite when a buffer is frozen, or its loop loses nothing;
+        a thawing buffer plays the rest of its loop first.
+        In a network an echo can pass through any buffer, so the longest delay and the highest loop gain are taken together.
+    */
+    double getTailLengthSeconds() const
+    {
+        double tail = 0.0;
+        double highestLoopGain = 0.0;
+
+        for (int i = 0; i < size; i++)
+        {
+            if (lineBusy[i] || lineBypassed(i))                                             // Left to a late job for now, or held silent
+                continue;
+
+            if (delays[i].isFrozen() && ! delays[i].isThawing())
+                return std::numeric_limits<double>::infinity();
+
+            tail = juce::jmax(tail, (delays[i].getThawSamplesLeft() + lineTailInSamples(i)) / sampleRate);
+            highestLoopGain = juce::jmax(highestLoopGain, effectiveLoopGain(i));
+        }
+
+        if (feedbackMatrix != FeedbackMatrix::none && highestLoopGain > 0.0)
+            tail = highestLoopGain >= 1.0 ? std::numeric_limits<double>::infinity()
+                                          : getLongestDelayInSamples() * (std::log(DelayLine<>::silenceThreshold) / std::log(highestLoopGain) + 1.0) / sampleRate;
+
+        return tail;
+    }
+
+
+    /** True while any buffer is thawing, so getTailLengthSeconds() changes as it plays. */
+    bool isThawing() const
+    {
+        for (int i = 0; i < size; i++)
+            if (! lineBusy[i] && delays[i].isThawing())
+                return true;
+
+        return false;
+    }
+
+
+    /** Number of buffers currently asleep, see processBlock(). */
+    int getNumSleepingLines() const
+    {
+        return int(std::count(std::begin(lineAsleep), std::end(lineAsleep), true));
+    }
+
+
+    /** Longest delay time of any buffer in samples, the length of one pass round the whole loop. */
+    int getLongestDelayInSamples() const
+    {
+        int longest = 0;
+        for (int i = 0; i < size; i++)
+            longest = juce::jmax(longest, hostDelayInSamples(i));
+        return longest;
+    }
+
+
+    /** Decimation factor of one buffer, 1 when it runs at the host rate. */
+    int getLineDecimation(int index) const
+    {
+        return resamplers[index].getFactor();
+    }
+
+
+    /**
+        Copies what one buffer still has to play, at float16 precision, as writeLoopState() does.
+        A decimated buffer is brought back to the host rate by linear interpolation.
+        Safe to call while the audio thread is processing. Never call it on the audio thread.
+        @param index: Buffer to copy
+        @param destination: Resized to the buffer's channels and frames
+        @return false if the audio thread kept overwriting the buffer during the copy
+    */
+    bool copyLine(int index, juce::AudioBuffer<float>& destination) const
+    {
+        std::vector<std::uint16_t> frames;
+
+        for (int attempt = 0; attempt < maxCopyAttempts; attempt++)
+        {
+            auto region = delays[index].getStoredRegion();
+            frames.resize(size_t(region.length) * size_t(numChannels));
+
+            if (delays[index].copyStoredRegion(region, frames.data()))
+            {
+                const int factor = resamplers[index].getFactor();
+                destination.setSize(numChannels, region.length * factor);
+
+                for (int channel = 0; channel < numChannels; channel++)
+                {
+                    auto stored = [&](int frame) { return SampleStorage::halfToFloat(frames[size_t(juce::jmin(frame, region.length - 1)) * size_t(numChannels) + size_t(channel)]); };
+
+                    for (int sample = 0; sample < region.length * factor; sample++)
+                    {
+                        const int frame = sample / factor;
+                        const float frac = float(sample % factor) / float(factor);
+                        destination.setSample(channel, sample, stored(frame) + frac * (stored(frame + 1) - stored(frame)));
+                    }
+                }
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+    /**
+        Writes what every buffer still has to play to stream, so a session can bring its loop back.
+        Each buffer's frames are stored as half floats at the rate the buffer runs at, after its decimation
+        factor. The half floats are mapped to signed integers that sort like the samples, see
+        SampleStorage::halfToOrdered(), and delta coded per channel so they compress well, a block at a time.
+        Safe to call while the audio thread is processing, see DelayLine::copyStoredRegion(); a buffer
+        that keeps getting overwritten during the copy is saved empty. Never call it on the audio thread.
+        @param stream: Stream to write to, usually a compressing one
+    */
+    void writeLoopState(juce::OutputStream& stream) const
+    {
+        stream.writeInt(loopStateVersion);
+        stream.writeDouble(sampleRate);
+        stream.writeInt(numChannels);
+        stream.writeInt(size);
+
+        std::vector<std::uint16_t> frames;
+        std::vector<std::uint16_t> block(size_t(loopStateBlockFrames) * size_t(numChannels));
+
+        for (int i = 0; i < size; i++)
+        {
+            copyStoredFrames(i, frames);
+            const int numFrames = int(frames.size()) / numChannels;
+            stream.writeInt(resamplers[i].getFactor());
+            stream.writeInt(numFrames);
+
+            std::int16_t previous[maxChannels] = {};
+            for (int frame = 0; frame < numFrames; frame += loopStateBlockFrames)
+            {
+                const int numSamples = juce::jmin(loopStateBlockFrames, numFrames - frame) * numChannels;
+                const std::uint16_t* source = frames.data() + size_t(frame) * size_t(numChannels);
+
+                for (int sample = 0; sample < numSamples; sample++)
+                {
+                    const int channel = sample % numChannels;
+                    const std::int16_t ordered = SampleStorage::halfToOrdered(source[sample]);
+                    block[size_t(sample)] = juce::ByteOrder::swapIfBigEndian(std::uint16_t(ordered - previous[channel]));   // Neighbouring samples are close, so most deltas are small
+                    previous[channel] = ordered;
+                }
+
+                stream.write(block.data(), size_t(numSamples) * sizeof(std::uint16_t));
+            }
+        }
+    }
+
+
+    /** Loop saved by writeLoopState(), decoded by decodeLoopState() and put back by restoreLoop(). */
+    struct SavedLoop
+    {
+        int numChannels = 0;                                    // Channels in every saved frame
+        std::vector<int> factors;                               // Decimation factor each buffer was saved at
+        std::vector<std::vector<std::uint16_t>> frames;         // Each buffer's frames, numChannels half floats each
+    };
+
+
+    /**
+        Copies what every buffer still has to play into loop, as writeLoopState() saves it but without the
+        coding, so restoreLoop() can put it back after the buffers are set up again. Safe to call while the
+        audio thread is processing. Never call it on the audio thread.
+        @param loop: Filled with every buffer's frames and decimation factor
+    */
+    void captureLoop(SavedLoop& loop) const
+    {
+        loop.numChannels = numChannels;
+        loop.factors.assign(size_t(size), 1);
+        loop.frames.assign(size_t(size), {});
+
+        for (int i = 0; i < size; i++)
+        {
+            loop.factors[i] = resamplers[i].getFactor();
+            copyStoredFrames(i, loop.frames[i]);
+        }
+    }
+
+
+    /**
+        Decodes a loop saved by writeLoopState(). Doesn't touch the buffers, so it can run while the audio
+        thread is processing; a loop saved at another sample rate or with another number of buffers is refused.
+        @param stream: Stream to read from
+        @param loop: Filled with the saved frames
+        @return true if the loop can be restored into these buffers
+    */
+    bool decodeLoopState(juce::InputStream& stream, SavedLoop& loop) const
+    {
+        const int version = stream.readInt();
+        if (version < 1 || version > loopStateVersion || stream.readDouble() != double(sampleRate))
+            return false;
+
+        const int savedChannels = stream.readInt();
+        if (savedChannels < 1 || savedChannels > maxChannels || stream.readInt() != size)
+            return false;
+
+        loop.numChannels = savedChannels;
+        loop.factors.assign(size_t(size), 1);
+        loop.frames.assign(size_t(size), {});
+
+        std::vector<std::uint16_t> block(size_t(loopStateBlockFrames) * size_t(savedChannels));
+
+        for (int i = 0; i < size; i++)
+        {
+            const int factor = version >= 2 ? stream.readInt() : 1;                        // Version 1 had every buffer at the host rate
+            const int numFrames = stream.readInt();
+            if (factor < 1 || factor > maxDecimation || (factor & (factor - 1)) != 0 || numFrames < 0 || stream.isExhausted())
+                return false;
+
+            loop.factors[i] = factor;
+
+            auto& frames = loop.frames[i];
+            frames.resize(size_t(numFrames) * size_t(savedChannels));
+            std::uint16_t previous[maxChannels] = {};
+
+            for (int frame = 0; frame < numFrames; frame += loopStateBlockFrames)
+            {
+                const int numSamples = juce::jmin(loopStateBlockFrames, numFrames - frame) * savedChannels;
+                const int numBytes = numSamples * int(sizeof(std::uint16_t));
+                if (stream.read(block.data(), numBytes) != numBytes)
+                    return false;
+
+                std::uint16_t* destination = frames.data() + size_t(frame) * size_t(savedChannels);
+
+                for (int sample = 0; sample < numSamples; sample++)
+                {
+                    const int channel = sample % savedChannels;
+                    previous[channel] = std::uint16_t(previous[channel] + juce::ByteOrder::swapIfBigEndian(block[size_t(sample)]));
+                    destination[sample] = version >= 3 ? SampleStorage::orderedToHalf(std::int16_t(previous[channel]))
+                                                       : previous[channel];                 // Before version 3 the half floats themselves were delta coded
+                }
+            }
+        }
+
+        return true;
+    }
+
+
+    /**
+        Puts a loop from decodeLoopState() into the buffers, so it is what the delays play next.
+        A buffer saved at another decimation factor is resampled to its own, see resampleFrames(), and
+        the oldest frames of a loop longer than its buffer are dropped. The audio thread must not be
+        using the MultiDelay meanwhile.
+        @param loop: Decoded loop
+    */
+    void restoreLoop(const SavedLoop& loop)
+    {
+        finishLateLines();
+
+        for (int i = 0; i < size; i++)
+        {
+            resamplers[i].reset();
+            delays[i].beginRestore();
+            lineAsleep[i] = false;
+            lineHeldUntil[i] = samplePosition;                                              // The loop fades out from here, see processLines()
+
+            const bool sameRate = loop.factors[i] == resamplers[i].getFactor();
+            const auto resampled = sameRate ? std::vector<std::uint16_t>() : resampleFrames(loop.frames[i], loop.numChannels, loop.factors[i], resamplers[i].getFactor());
+            const auto& frames = sameRate ? loop.frames[i] : resampled;
+
+            const int numFrames = int(frames.size()) / loop.numChannels;
+            const int skipped = juce::jmax(0, numFrames - delays[i].getCapacityInFrames()); // Oldest frames that no longer fit
+
+            if (numFrames > skipped)
+                delays[i].restoreFrames(0, frames.data() + size_t(skipped) * size_t(loop.numChannels), numFrames - skipped, loop.numChannels);
+
+            delays[i].finishRestore(numFrames - skipped);
+        }
+
+        filterBank.reset();
+    }
+
+
+    /**
+        Brings a buffer's saved frames from one decimation factor to another, so a loop survives the
+        buffers being set up at other rates. Going down in rate each frame is the average of the frames
+        it covers, which the Bass band-pass after it leaves clean; going up the frames are interpolated
+        linearly, as copyLine() does. Factors are powers of two, see decodeLoopState().
+        @param frames: Half float frames, channels interleaved
+        @param channels: Channels in every frame
+        @param fromFactor: Factor the frames were stored at
+        @param toFactor: Factor to bring them to
+    */
+    static std::vector<std::uint16_t> resampleFrames(const std::vector<std::uint16_t>& frames, int channels, int fromFactor, int toFactor)
+    {
+        const int numFrames = int(frames.size()) / channels;
+        const int numOut = int(juce::int64(numFrames) * fromFactor / toFactor);
+        std::vector<std::uint16_t> resampled(size_t(numOut) * size_t(channels));
+
+        auto stored = [&](int frame, int channel) { return SampleStorage::halfToFloat(frames[size_t(juce::jmin(frame, numFrames - 1)) * size_t(channels) + size_t(channel)]); };
+
+        for (int frame = 0; frame < numOut; frame++)
+        {
+            for (int channel = 0; channel < channels; channel++)
+            {
+                float value = 0.0f;
+                if (toFactor > fromFactor)
+                {
+                    const int ratio = toFactor / fromFactor;
+                    for (int k = 0; k < ratio; k++)
+                        value += stored(frame * ratio + k, channel);
+                    value /= float(ratio);
+                }
+                else
+                {
+                    const int ratio = fromFactor / toFactor;
+                    const int source = frame / ratio;
+                    const float frac = float(frame % ratio) / float(ratio);
+                    value = stored(source, channel) + frac * (stored(source + 1, channel) - stored(source, channel));
+                }
+
+                resampled[size_t(frame) * size_t(channels) + size_t(channel)] = SampleStorage::floatToHalf(value);
+            }
+        }
+
+        return resampled;
+    }
+
+
+    /**
+        Streams frames saved by writeLoopState() back into the buffers, see decodeLoopState() and restoreLoop().
+        The audio thread must not be using the MultiDelay meanwhile.
+        @param stream: Stream to read from
+        @return true if the buffers were restored
+    */
+    bool readLoopState(juce::InputStream& stream)
+    {
+        SavedLoop loop;
+        if (! decodeLoopState(stream, loop))
+            return false;
+
+        restoreLoop(loop);
+        return true;
+    }
+
+
+    /**
+        Lets processBlock() spread the delay buffers over a pool of worker threads.
+        Each job runs a run of neighbouring buffers, and each buffer only writes its own lane of
+        frameBuffer, so the output is identical to single-threaded processing.
+        A block runs single-threaded while the pool is backing off after a missed deadline, or is busy
+        with another MultiDelay's batch. Buffers whose job is still running at the deadline are left
+        silent, and left alone, until the job finishes.
+        Call while processBlock() is not running.
+        @param pool: Started pool to use, possibly shared with other MultiDelays, or nullptr for single-threaded processing
+    */
+    void setWorkerPool(DelayWorkerPool* pool)
+    {
+        finishLateLines();
+        workerPool = pool;
+        numLineJobs = 0;
+
+        if (workerPool != nullptr && workerPool->getNumWorkers() > 0)
+            numLineJobs = juce::jmin(size, (workerPool->getNumWorkers() + 1) * jobsPerThread);    // A few jobs per thread so a slow thread doesn't hold the rest up
+    }
+
+
+    /**
+        Returns the centre frequency of the band-pass filter for one buffer.
+        @param index: index of buffer in the vector
+        @param type: Type of filter (Low-Pass, Wide-Band and High-Pass)
+    */
+    float lineFilterFrequency(int index, int type) const
+    {
+        if (type >= 0 && type < int(bandFrequencyTable.size()))
+            return bandFrequencyTable[type][index];
+
+        return 0.0f;
+    }
+
 
     /**
         Returns the sum of all the delay buffers.
@@ -125,43 +663,589 @@ public:
     */
     float delaySumAudioVectors(float sample, int filterType, double qVal)
     {      
-        vectSum = 0;                                                                                // Sets vectorSum default to 0 for each iteration
+        float outSample = 0.0f;
+        setFilter(filterType, qVal);
+        processBlock(&sample, &outSample, 1);                                                       // A single sample is just a block of one
+
+        return outSample;
+    }
+
 
-        for (int i = 0; i < size; i++)                                                              // For loop to add the output sample of each Oscilator in the vector. 
+    /**
+        Sets the filter used by processBlock(). Call once per block, before processBlock().
+        @param type: Type of filter (Low-Pass, Wide-Band and High-Pass)
+        @param qVal: Q for filter bands.
+    */
+    void setFilter(int type, float qVal)
+    {
+        blockFilterType = type;
+        blockQ = qVal;
+    }
+
+
+    /**
+        Block version of delaySumAudioVectors(), for every linked channel at once.
+        Runs one delay buffer and its filter across the whole block before moving to the next one,
+        so each buffer is streamed through once per block instead of being revisited every sample.
+        Each DelayLine only feeds back into itself, so the result matches the per-sample path.
+        A buffer is put to sleep once the input has been quiet for long enough that its echoes are below
+        DelayLine::silenceThreshold at the output, see lineTailInSamples(): it is cleared and skipped, its
+        lane left silent, until an input sample above the threshold arrives. Buffers only fall asleep every
+        sleepInterval samples counted from delaySetup(), and wake on the very sample the input comes back,
+        so the output doesn't depend on how the host splits its blocks.
+        @param in: one input block per channel
+        @param out: one output block per channel, may not alias in
+        @param numSamples: number of samples in the block
+    */
+    void processBlock(const float* const* in, float* const* out, int numSamples)
+    {
+        retireLateLines();
+
+        for (int start = 0; start < numSamples; start += blockSize)                                 // Splits blocks larger than the size given to delaySetup()
         {
-            filterSample = delayBufferFilter(delayVec[i]->process(sample), i, filterType, qVal);    // Calls the filter function for each buffer
-            vectSum += filterSample * (0.2 * ((size / 2) - i));                                     // Adds tge proccessed sample to vectorSum in order to add al the samples from each buffer, and reducing the gain for each subsequent buffer.
+            int numToDo = juce::jmin(blockSize, numSamples - start);
+
+            const float* chunkIn[maxChannels];
+            for (int channel = 0; channel < numChannels; channel++)
+                chunkIn[channel] = in[channel] + start;
+
+            findQuietInput(chunkIn, numToDo);
+
+            if (lineTailsDirty || tailFilterType != blockFilterType)
+                updateLineTails();
+
+            if (feedbackMatrix != FeedbackMatrix::none && ! anyLineFrozen() && ! anyLineDecimated && ! anyLineBusy)
+            {
+                processNetwork(chunkIn, numToDo);
+            }
+            else
+            {
+                const bool spread = numLineJobs > 0 && workerPool->isAvailable() && runLineJobs(chunkIn, numToDo);     // Not while the pool backs off, or is busy with another MultiDelay
+                if (! spread)
+                    processLines(0, size, { chunkIn, frameBuffer.data(), quietBefore.data(), nextLoud.data(), samplePosition, numToDo });
+            }
+
+            if (blockFilterType != appliedFilterType)                                               // New band: jump straight to it
+            {
+                setBankCoefficients(blockQ);
+                filterBank.processAndMix(frameBuffer.data(), lineGains.data(), out, start, numToDo);
+            }
+            else if (blockQ != appliedQ)                                                            // Q is ramping: step through the cached entries across the block
+            {
+                for (int pos = 0; pos < numToDo; pos += qRampInterval)
+                {
+                    int numInStep = juce::jmin(qRampInterval, numToDo - pos);
+                    setBankCoefficients(appliedQ + (blockQ - appliedQ) * float(pos + numInStep) / numToDo);
+                    filterBank.processAndMix(frameBuffer.data() + pos * stride, lineGains.data(), out, start + pos, numInStep);
+                }
+            }
+            else
+            {
+                filterBank.processAndMix(frameBuffer.data(), lineGains.data(), out, start, numToDo);   // Nothing changed, the filters keep their coefficients
+            }
+
+            appliedFilterType = blockFilterType;
+            appliedQ = blockQ;
+            samplePosition += numToDo;
         }
+    }
 
-        outSample = vectSum / size;                                                                 // Divides the final output with the number of oscilators to avoid distortion. 
-    
-        return outSample;
+
+    /**
+        Single channel version of processBlock(), for a MultiDelay set up with one channel.
+        @param in: input block
+        @param out: output block, may not alias in
+        @param numSamples: number of samples in the block
+    */
+    void processBlock(const float* in, float* out, int numSamples)
+    {
+        jassert(numChannels == 1);
+        processBlock(&in, &out, numSamples);
     }
   
 private:
 
-    DelayLine delays[20];                                       // An array of 20 delayLine instances 
-    // Initializing all the buffers into a vector of size 20. 
-    std::vector <DelayLine*> delayVec{ &delays[0], &delays[1], &delays[2], &delays[3], &delays[4], &delays[5], &delays[6], &delays[7], &delays[8], &delays[9], &delays[10], &delays[11], &delays[12], &delays[13], &delays[14], &delays[15], &delays[16], &delays[17], &delays[18], &delays[19] };
+    /** A block as processLines() sees it. */
+    struct LineChunk
+    {
+        const float* const* input = nullptr;                    // One input block per channel
+        float* frames = nullptr;                                // frameBuffer, or the block a batch of jobs was started on
+        const int* quietBefore = nullptr;                       // See findQuietInput()
+        const int* nextLoud = nullptr;
+        juce::int64 position = 0;                               // samplePosition at the start of the block
+        int numSamples = 0;
+    };
+
+
+    /**
+        Streams a block through a run of delay buffers, each into its lane of every channel's group.
+        @param first: index of the first buffer
+        @param last: index one past the last buffer
+        @param chunk: the block to process
+    */
+    void processLines(int first, int last, const LineChunk& chunk)
+    {
+        const int numToDo = chunk.numSamples;
+        float* frames = chunk.frames;
+
+        for (int i = first; i < last; i++)
+        {
+            if (lineBusy[i].load(std::memory_order_relaxed))                                        // Still in a late job's hands
+            {
+                silenceLane(frames, i, 0, numToDo);
+                continue;
+            }
+
+            if (lineBypassed(i))                                                                    // Holds its loop, silent, until the filter type is Bass again
+            {
+                silenceLane(frames, i, 0, numToDo);
+                resamplers[i].reset();                                                              // So it starts again cleanly, not from the history it had
+                continue;
+            }
+
+            if (delays[i].isFrozen())                                                               // A frozen loop plays whatever the input does, and starts fading once thawed
+            {
+                const int thawLeft = delays[i].getThawSamplesLeft();
+                lineHeldUntil[i] = chunk.position + (thawLeft > 0 ? thawLeft : numToDo);
+                lineAsleep[i] = false;
+            }
+
+            for (int pos = 0; pos < numToDo;)
+            {
+                if (lineAsleep[i])                                                                  // Nothing to play until the input comes back
+                {
+                    const int wake = chunk.nextLoud[pos];
+                    silenceLane(frames, i, pos, wake);
+                    if (wake == numToDo)
+                        break;
+
+                    lineAsleep[i] = false;
+                    pos = wake;
+                }
+
+                const int sleepAt = findSleepPoint(i, pos, chunk);
+                const float* segmentIn[maxChannels];
+                for (int channel = 0; channel < numChannels; channel++)
+                    segmentIn[channel] = chunk.input[channel] + pos;
+
+                if (resamplers[i].getFactor() > 1)
+                    resamplers[i].process(delays[i], segmentIn, frames + pos * stride + i, sleepAt - pos, stride, groupStride);    // Same, with the buffer running at its decimated rate
+                else
+                    delays[i].processBlock(segmentIn, frames + pos * stride + i, sleepAt - pos, stride, groupStride);   // Streams the whole block through one buffer, into lane i of every channel's group
+
+                if (sleepAt < numToDo)
+                {
+                    lineAsleep[i] = true;
+                    delays[i].scheduleClear();                                                      // Drops what is left below the threshold, so waking up starts from silence
+                    resamplers[i].reset();
+                }
+                pos = sleepAt;
+            }
+        }
+    }
+
+
+    /**
+        True while a decimated buffer is given a band other than Bass. Its rate, and its decimator, were
+        chosen for the Bass band, so the Wide and High bands would come back aliased: the buffer is held,
+        silent and untouched, from the first block of the new filter type until the type is Bass again
+        or delaySetup() runs the buffers at the host rate.
+    */
+    bool lineBypassed(int index) const
+    {
+        return blockFilterType != 0 && resamplers[index].getFactor() > 1;
+    }
+
+
+    /**
+        Copies the frames one buffer still has to play as half floats, see DelayLine::copyStoredRegion().
+        Left empty if the audio thread kept overwriting them during the copy.
+    */
+    void copyStoredFrames(int index, std::vector<std::uint16_t>& frames) const
+    {
+        for (int attempt = 0; attempt < maxCopyAttempts; attempt++)
+        {
+            const auto region = delays[index].getStoredRegion();
+            frames.resize(size_t(region.length) * size_t(numChannels));
+            if (delays[index].copyStoredRegion(region, frames.data()))
+                return;
+        }
+
+        frames.clear();
+    }
+
+
+    /** Zeroes samples from to to of one buffer's lane in every channel group. */
+    void silenceLane(float* frames, int index, int from, int to) const
+    {
+        for (int s = from; s < to; s++)
+            for (int channel = 0; channel < numChannels; channel++)
+                frames[s * stride + channel * groupStride + index] = 0.0f;
+    }
+
+
+    /**
+        First sample from pos on where a buffer falls asleep: a multiple of sleepInterval samples after
+        delaySetup(), with the input quiet there and for at least the buffer's tail before it, and the
+        buffer not frozen or thawing for its tail either. The block's length if there is none.
+    */
+    int findSleepPoint(int index, int pos, const LineChunk& chunk) const
+    {
+        const double tail = lineTails[index];
+        if (! (tail < double(maxQuietRun)))
+            return chunk.numSamples;
+
+        const int offset = int((sleepInterval - chunk.position % sleepInterval) % sleepInterval);    // First multiple of sleepInterval in the block
+        for (int s = offset + (juce::jmax(0, pos - offset) + sleepInterval - 1) / sleepInterval * sleepInterval; s < chunk.numSamples; s += sleepInterval)
+            if (chunk.nextLoud[s] != s && chunk.quietBefore[s] >= tail && double(chunk.position + s - lineHeldUntil[index]) >= tail)
+                return s;
+
+        return chunk.numSamples;
+    }
+
+
+    /**
+        processLines() for a feedback delay network. Every buffer is read for as much of the block as the
+        shortest delay allows, the outputs are mixed through feedbackMatrix, and each buffer then writes
+        its input plus its share of the mix, so the feedback is exact to the sample.
+        @param chunkIn: one input block per channel
+        @param numToDo: number of samples in the block
+    */
+    void processNetwork(const float* const* chunkIn, int numToDo)
+    {
+        std::fill(std::begin(lineAsleep), std::end(lineAsleep), false);                           // Energy moves between buffers, so none of them can sleep
+        std::fill(std::begin(lineHeldUntil), std::end(lineHeldUntil), samplePosition + numToDo);   // and each one's tail starts when the network stops
+
+        int splitLength = numToDo;
+        for (int i = 0; i < size; i++)
+            splitLength = juce::jmin(splitLength, delays[i].getLongestSplitBlock());
+
+        for (int pos = 0; pos < numToDo; pos += splitLength)
+        {
+            const int numInSplit = juce::jmin(splitLength, numToDo - pos);
+            float* frames = frameBuffer.data() + pos * stride;
+            float* mixed = feedbackBuffer.data() + pos * stride;
+
+            for (int i = 0; i < size; i++)
+                delays[i].readBlock(frames + i, numInSplit, stride, groupStride);
+
+            feedbackMixer.mix(feedbackMatrix, frames, mixed, numInSplit, stride, numChannels);
+
+            const float* splitIn[maxChannels];
+            for (int channel = 0; channel < numChannels; channel++)
+                splitIn[channel] = chunkIn[channel] + pos;
+
+            for (int i = 0; i < size; i++)
+                delays[i].writeBlock(splitIn, mixed + i, numInSplit, stride, groupStride);
+        }
+    }
+
+
+    bool anyLineFrozen() const
+    {
+        for (int i = 0; i < size; i++)
+            if (! lineBusy[i] && delays[i].isFrozen())
+                return true;
+
+        return false;
+    }
+
+
+    /**
+        Marks where the block's input is above DelayLine::silenceThreshold on any channel: quietBefore[s]
+        counts the quiet samples just before sample s, and nextLoud[s] is the first loud sample from s on,
+        numToDo if there is none.
+    */
+    void findQuietInput(const float* const* chunkIn, int numToDo)
+    {
+        for (int s = 0; s < numToDo; s++)
+        {
+            bool loud = false;
+            for (int channel = 0; channel < numChannels; channel++)
+                loud = loud || std::abs(chunkIn[channel][s]) > DelayLine<>::silenceThreshold;
+
+            quietBefore[s] = quietRun;
+            quietRun = loud ? 0 : juce::jmin(quietRun + 1, maxQuietRun);
+            nextLoud[s] = loud ? s : -1;
+        }
+
+        for (int s = numToDo - 1, next = numToDo; s >= 0; s--)
+        {
+            if (nextLoud[s] == s)
+                next = s;
+            nextLoud[s] = next;
+        }
+    }
+
+
+    /**
+        Gain of one pass round a buffer's feedback loop at the centre of its band: the feedback times what
+        the interpolated read leaves of the band. A feedback clamped to 1 still loses a little on every pass
+        whenever the delay falls between two samples. Components far below the band can last longer, but
+        the band-pass filter keeps most of them from the output.
+    */
+    double effectiveLoopGain(int index) const
+    {
+        if (lineBypassed(index))                                                                    // Its band would sit above the buffer's Nyquist
+            return 0.0;
+
+        const double omega = juce::MathConstants<double>::twoPi * lineFilterFrequency(index, blockFilterType) * resamplers[index].getFactor() / sampleRate;
+        const float delay = lineDelayTimes[index];
+        return delays[index].getFeedback() * LineInterpolation::magnitude(delay - std::floor(delay), float(omega));
+    }
+
+
+    /**
+        Samples of quiet input after which a buffer's echoes stay below DelayLine::silenceThreshold at the
+        output: a full scale echo, scaled by the buffer's mix gain, shrinks by effectiveLoopGain() on every pass.
+        Infinite when the loop loses nothing. Input above full scale leaves echoes a little longer than this.
+    */
+    double lineTailInSamples(int index) const
+    {
+        const double level = std::abs(lineGainTable[index]);
+        if (level <= DelayLine<>::silenceThreshold || lineBypassed(index))                         // Not even the first echo is heard
+            return 0.0;
+
+        const double loopGain = effectiveLoopGain(index);
+        if (loopGain >= 1.0)
+            return std::numeric_limits<double>::infinity();
+
+        const double repeats = loopGain > 0.0 ? std::log(DelayLine<>::silenceThreshold / level) / std::log(loopGain) : 0.0;    // Passes through the feedback loop before the echo is inaudible
+        return hostDelayInSamples(index) * (repeats + 1.0);
+    }
+
+
+    /** Works out every buffer's tail again, for the sleep test. */
+    void updateLineTails()
+    {
+        for (int i = 0; i < size; i++)
+            if (! lineBusy[i])                                                                      // A busy buffer is worked out again once its job finishes
+                lineTails[i] = lineTailInSamples(i);
+
+        tailFilterType = blockFilterType;
+        lineTailsDirty = false;
+    }
+
+
+    /**
+        Delay time a buffer is given for a delay in host rate samples, in the buffer's own rate.
+        The feedback loop runs inside the buffer, so the repeats keep their spacing exactly; only the
+        first echo comes the resampler's latency late, a millisecond at most.
+        @param index: index of buffer in the vector
+        @param hostDelay: Delay in host rate samples
+    */
+    float lineDelayTime(int index, float hostDelay) const
+    {
+        const int factor = resamplers[index].getFactor();
+        if (factor == 1)
+            return hostDelay;
+
+        return juce::jmax(1.0f, hostDelay / float(factor));
+    }
+
+
+    /** Delay of one buffer's first echo in host rate samples, as it is heard. */
+    int hostDelayInSamples(int index) const
+    {
+        return delays[index].getDelayTimeInSamples() * resamplers[index].getFactor() + resamplers[index].getLatencyInSamples();
+    }
+
+
+    /** Hands a buffer the delay time and feedback of the last delayAssignValue() call. */
+    void applyLineValues(int index)
+    {
+        lineDelayTimes[index] = lineDelayTime(index, delayTimeInSamples(index, juce::jmin(assignedDelayLength, maxDelayLength)));   // Never asks for more than delaySetup() allocated for
+        delays[index].setDelayTimeInSamples(lineDelayTimes[index]);
+        delays[index].setFeedback(feedbackScaleTable[index] * assignedFeedback);           // The feedbackIn parameter value is scaled for each buffer
+        lineTailsDirty = true;
+    }
+
+
+    /**
+        Spreads the buffers over the worker pool. The jobs work on their own copy of the input, and
+        on the frame and quiet input blocks they were started on: if the pool misses its deadline, the buffers of jobs
+        still running are marked busy, and frameBuffer moves to spareFrameBuffer with their lanes
+        silent, so the audio thread carries on without touching anything those jobs use.
+        @param chunkIn: one input block per channel
+        @param numToDo: number of samples in the block
+        @return false if the pool was busy with another caller's batch and nothing was processed
+    */
+    bool runLineJobs(const float* const* chunkIn, int numToDo)
+    {
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            float* copy = lineJobInputBuffer.data() + channel * blockSize;
+            std::copy(chunkIn[channel], chunkIn[channel] + numToDo, copy);
+            lineJobInput[channel] = copy;
+        }
+
+        lineJobChunk = { lineJobInput, frameBuffer.data(), quietBefore.data(), nextLoud.data(), samplePosition, numToDo };
+        for (int job = 0; job < numLineJobs; job++)
+            lineJobDone[job].store(false, std::memory_order_relaxed);
+
+        const auto outcome = workerPool->run(&processLineJob, this, numLineJobs, workerDeadline * numToDo / sampleRate);
+        if (outcome != DelayWorkerPool::Outcome::late)
+            return outcome == DelayWorkerPool::Outcome::done;
 
-    juce::IIRFilter filter[20];                                 // An array of 20 filter instances. (20 filters for 20 delayBuffers)
-    // Initialiszing all the filters into a vector of size 20. 
-    // *** For every delayBuffer, add a filter as well ***
-    std::vector <juce::IIRFilter*> filterVec{ &filter[0], &filter[1], &filter[2], &filter[3], &filter[4], &filter[5], &filter[6], &filter[7], &filter[8], &filter[9], &filter[10], &filter[11], &filter[12], &filter[13], &filter[14], &filter[15], &filter[16], &filter[17], &filter[18], &filter[19] };
+        for (int job = 0; job < numLineJobs; job++)
+            if (! lineJobDone[job].load(std::memory_order_acquire))
+                for (int i = job * size / numLineJobs; i < (job + 1) * size / numLineJobs; i++)
+                {
+                    lineBusy[i].store(true, std::memory_order_relaxed);
+                    anyLineBusy = true;
+                }
+
+        if (! anyLineBusy)
+            return true;
+
+        for (int s = 0; s < numToDo; s++)                                                           // Only reads the lanes of finished jobs
+            for (int channel = 0; channel < numChannels; channel++)
+                for (int i = 0; i < size; i++)
+                {
+                    const int lane = s * stride + channel * groupStride + i;
+                    spareFrameBuffer[lane] = lineBusy[i] ? 0.0f : frameBuffer[lane];
+                }
+
+        std::swap(frameBuffer, spareFrameBuffer);                                                   // The late jobs keep the old block to themselves
+        std::swap(quietBefore, spareQuietBefore);
+        std::swap(nextLoud, spareNextLoud);
+        return true;
+    }
+
+
+    /** DelayWorkerPool job: runs one share of the delay buffers. */
+    static void processLineJob(void* context, int jobIndex)
+    {
+        auto& self = *static_cast<MultiDelay*>(context);
+
+        self.processLines(jobIndex * size / self.numLineJobs, (jobIndex + 1) * size / self.numLineJobs, self.lineJobChunk);
+        self.lineJobDone[jobIndex].store(true, std::memory_order_release);
+    }
+
+
+    /**
+        Hands the buffers of late jobs back to the audio thread once the jobs have finished, catching
+        up with the delay times and clears they missed meanwhile.
+    */
+    void retireLateLines()
+    {
+        if (! anyLineBusy || ! workerPool->isIdle())
+            return;
+
+        for (int i = 0; i < size; i++)
+        {
+            if (! lineBusy[i])
+                continue;
+
+            lineBusy[i] = false;
+            if (assignedDelayLength > 0.0f)
+                applyLineValues(i);
+
+            if (clearWhenIdle[i])
+            {
+                delays[i].scheduleClear();
+                resamplers[i].reset();
+                clearWhenIdle[i] = false;
+            }
+        }
+
+        anyLineBusy = false;
+    }
+
+
+    /** Waits for late jobs and takes their buffers back. Never call from the audio thread. */
+    void finishLateLines()
+    {
+        if (anyLineBusy)
+        {
+            workerPool->waitUntilIdle();
+            retireLateLines();
+        }
+    }
+
+
+    /**
+        Loads the cached coefficients of every buffer's band into the filter bank.
+        @param qVal: Q for filter bands.
+    */
+    void setBankCoefficients(float qVal)
+    {
+        for (int i = 0; i < size; i++)
+            filterBank.setCoefficients(i, coefficientCache.getCoefficients(blockFilterType, i, qVal));
+    }
+
+
+    using LineInterpolation = LinearInterpolation;              // Interpolation used by every buffer, see Interpolation.h for the alternatives
+    using Line = DelayLine<LineInterpolation>;
+
+    static constexpr auto lineGainTable = MultiDelayTables::makeLineGains<numLines>();
+    static constexpr auto feedbackScaleTable = MultiDelayTables::makeFeedbackScales<numLines>();
+    static constexpr auto delayScaleTable = MultiDelayTables::makeDelayScales<numLines>();
+    static constexpr auto bandFrequencyTable = MultiDelayTables::makeBandFrequencies<numLines>();
+
+    Line delays[numLines];                                      // An array of numLines delayLine instances 
+    LineResampler resamplers[numLines];                         // Runs each buffer at its decimated rate, factor 1 when it runs at the host rate
+
+    BiquadBank filterBank;                                      // One band-pass filter per delayBuffer, stored side by side
 
     float sampleRate;                                           // store Sample Rate
-    float vectSum;                                              // store sum of the vectors.
-    float outSample;                                            // store final output sample
-    float size;                                                 // store size of the vectors.    
-    float filterFreq;                                           // store frequency value in delayBufferFilter()
-    float filterSample;                                         // store filtered sample 
-    float bufferSize ;                                          // store bufferSize 
-    float maxDelayLength;                                       // store Max Delay Length
-    float delayLength;                                          // store Delay Length
-    float feedbackVal;                                          // store feedback Value
-    float filterOut;                                            // store the filtered sample in dealyBufferFilter()
-   
-    juce::SmoothedValue<float> smoothfilterFreq;                // Soomthed Value instance for filter frequency 
+    float maxDelayLength;                                       // store the largest delayLength parameter value the buffers are sized for
+    float assignedDelayLength = 0.0f;                           // delayLengthIn of the last delayAssignValue() call, 0 before the first
+    float assignedFeedback = 0.0f;                              // feedbackIn of the last delayAssignValue() call
+    bool anyLineDecimated = false;                              // Some buffer runs below the host rate, see lineDecimation()
+    int blockSize = 0;                                          // store the largest block processBlock() handles in one go
+    bool clearToggleHeld = false;                               // delayToggleVal of the last clearDelayBuffers() call
+    bool lineAsleep[numLines] = {};                             // Buffers that have decayed to silence and are skipped
+    float lineDelayTimes[numLines] = {};                        // Delay time each buffer was last given, in its own rate
+    double lineTails[numLines] = {};                            // lineTailInSamples() of each buffer, for the sleep test
+    bool lineTailsDirty = true;                                 // lineTails needs working out again
+    int tailFilterType = -1;                                    // Filter type lineTails was worked out for
+    juce::int64 samplePosition = 0;                             // Samples processed since delaySetup(), the sleep test's clock
+    juce::int64 lineHeldUntil[numLines] = {};                   // Sample each buffer was last frozen, thawing, restored or in a network until
+    int quietRun = 0;                                           // Quiet input samples up to the block being processed
+    std::vector<int> quietBefore;                               // Quiet input samples before each sample of the block, see findQuietInput()
+    std::vector<int> nextLoud;                                  // First input sample above the threshold from each sample of the block on
+    std::vector<int> spareQuietBefore;                          // Stand in for quietBefore and nextLoud after a job overruns its deadline
+    std::vector<int> spareNextLoud;
+    static constexpr int maxQuietRun = 1 << 30;                 // quietRun stops counting here
+    static constexpr int sleepInterval = 64;                    // Buffers only fall asleep on multiples of this many samples
+    int blockFilterType = 0;                                    // filter type used by processBlock()
+    float blockQ = 0.5f;                                        // filter Q used by processBlock()
+    int appliedFilterType = -1;                                 // filter type the filters currently hold
+    float appliedQ = 0.5f;                                      // filter Q the filters currently hold
+    static constexpr int qRampInterval = 16;                    // samples between coefficient updates while Q ramps
+
+    int numChannels = 1;                                        // store number of linked channels
+    int stride = 0;                                             // floats per frame in frameBuffer, one group per channel
+    int groupStride = 0;                                        // floats per channel group, size rounded up to whole SIMD registers
+    std::vector<float> frameBuffer;                             // processBlock() scratch, one frame of buffer outputs per sample
+    std::vector<float> lineGains;                               // mix gain of each buffer
+    std::vector<float> feedbackBuffer;                          // processNetwork() scratch, frameBuffer mixed through feedbackMatrix
+    FeedbackMixer feedbackMixer;                                // Applies feedbackMatrix
+    FeedbackMatrix feedbackMatrix = FeedbackMatrix::none;       // How the buffers feed back, see setFeedbackMatrix()
+
+    BandPassCoefficientCache coefficientCache;                  // Pre-designed band-pass coefficients for every buffer
+
+    DelayWorkerPool* workerPool = nullptr;                      // Pool the buffers are spread over, nullptr when single-threaded
+    int numLineJobs = 0;                                        // Jobs the buffers are split into, 0 when single-threaded
+    const float* lineJobInput[maxChannels] = {};               // Input of the block the jobs are working on, in lineJobInputBuffer
+    LineChunk lineJobChunk;                                     // Block the jobs are working on
+    std::atomic<bool> lineJobDone[numLines] {};                 // Jobs of the current batch that have finished
+    std::vector<float> lineJobInputBuffer;                      // Copy of the block's input, so a late job never reads the host's buffers
+    std::vector<float> spareFrameBuffer;                        // Stands in for frameBuffer after a job overruns its deadline
+    std::atomic<bool> lineBusy[numLines] {};                    // Buffers a late job is still running, skipped until it finishes; the job itself skips those it hasn't reached
+    bool clearWhenIdle[numLines] = {};                          // Busy buffers that missed a clear
+    bool anyLineBusy = false;                                   // Some buffer is busy, see runLineJobs()
+    static constexpr int jobsPerThread = 2;                     // Jobs per thread in a batch
+    static constexpr double workerDeadline = 0.5;               // Share of the block's duration the buffers may take before the pool backs off
+    static constexpr float seamFadeSeconds = 0.01f;             // Crossfade over the seam of a frozen loop
+    static constexpr float delayGlideSeconds = 0.05f;           // Shortest glide to a new delay time
+    static constexpr float maxDelayGlideStep = 0.5f;            // Fastest glide, the read head runs at half to one and a half times normal speed
+    static constexpr int loopStateVersion = 3;                  // Layout written by writeLoopState(), 2 added each buffer's decimation factor, 3 ordered deltas
+    static constexpr int maxDecimation = 16;                    // Lowest rate a buffer runs at, as a fraction of the host rate
+    static constexpr float minRateToBand = 16.0f;               // A decimated buffer's rate is at least this many times its band's centre, see LineResampler
+    static constexpr int maxCopyAttempts = 4;                   // Tries at copying a buffer the audio thread keeps overwriting
+    static constexpr int loopStateBlockFrames = 4096;           // Frames coded at once by writeLoopState() and decodeLoopState()
 
 };
 
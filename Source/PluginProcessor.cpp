@@ -9,6 +9,16 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
+namespace
+{
+    /** A switch that runs a command once, like Export Loop. Hosts can't automate it, so a preset or a lane never triggers it. */
+    struct CommandParameter : juce::AudioParameterBool
+    {
+        using juce::AudioParameterBool::AudioParameterBool;
+        bool isAutomatable() const override { return false; }
+    };
+}
+
 //==============================================================================
 AudioProg_assignment3AudioProcessor::AudioProg_assignment3AudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -32,7 +42,16 @@ AudioProg_assignment3AudioProcessor::AudioProg_assignment3AudioProcessor()
             std::make_unique<juce::AudioParameterFloat>("delayFeedback", "Feedback", 0.01f, 0.9f, 0.05f),                               // Delay Feedback, Range: 0.01 - 0.9, Default: 0.05
             std::make_unique<juce::AudioParameterBool>("delayToggle", "Delay Clear", false),                                            // Delay Toggle, Range: 0.0 - 1.0, Default: 0.2 (Delay buffer Clear)
             std::make_unique<juce::AudioParameterChoice>("filterType", "Filter Type", juce::StringArray({"Bass", "Wide", "High"}), 0),  // Filter Type, Choice: (Bass, Wide, High), Default: 0
-            std::make_unique<juce::AudioParameterFloat>("filterQ", "Filter Q", 0.1f, 18.0f, 0.5f)                                       // Q for filter, Range: 0.1 - 18.0, Default: 0.5           
+            std::make_unique<juce::AudioParameterFloat>("filterQ", "Filter Q", 0.1f, 18.0f, 0.5f),                                      // Q for filter, Range: 0.1 - 18.0, Default: 0.5           
+            std::make_unique<juce::AudioParameterChoice>("storageFormat", "Delay Storage", juce::StringArray({"Float 32", "Float 16", "Int 16"}), 0),  // Sample format of the delay buffers, Float 16 and Int 16 halve the memory
+            std::make_unique<juce::AudioParameterBool>("multiCore", "Multi-core Delays", false),                                         // Spreads the delay buffers over worker threads, Default: false
+            std::make_unique<juce::AudioParameterBool>("freeze", "Freeze", false),                                                      // Holds the delay buffers and loops them read-only, Default: false
+            std::make_unique<juce::AudioParameterBool>("saveLoop", "Save Loop In Session", false),                                      // Stores the delay buffers with the session, Default: false
+            std::make_unique<CommandParameter>("exportLoop", "Export Loop", false),                                                      // Writes the loop to the Music folder when switched on, then switches back off, Default: false
+            std::make_unique<juce::AudioParameterChoice>("exportMode", "Export As", juce::StringArray({"Mix WAV", "Mix FLAC", "Lines WAV", "Lines FLAC"}), 0),  // What Export Loop writes, Choice: (Mix WAV, Mix FLAC, Lines WAV, Lines FLAC), Default: 0
+            std::make_unique<juce::AudioParameterChoice>("oversampling", "Drive Oversampling", juce::StringArray({"Off", "2x", "4x"}), 0),  // Oversampling of the overdrive, Choice: (Off, 2x, 4x), Default: 0
+            std::make_unique<juce::AudioParameterChoice>("delayNetwork", "Delay Network", juce::StringArray({"Off", "Householder", "Hadamard"}), 0),   // Mixes the delay buffers' feedback through an orthogonal matrix, Choice: (Off, Householder, Hadamard), Default: 0
+            std::make_unique<juce::AudioParameterBool>("multirate", "Multirate Bass Delays", false)                                     // Stores the Bass buffers at decimated rates, a fraction of the memory and work, Default: false
         })
 {
     // Link the input parameters to their respective variables
@@ -46,33 +65,326 @@ AudioProg_assignment3AudioProcessor::AudioProg_assignment3AudioProcessor()
     filterChoiceParam = parameters.getRawParameterValue("filterType");
     delayToggleParam = parameters.getRawParameterValue("delayToggle");
     recLoopParam = parameters.getRawParameterValue("recLoop");    
+    storageFormatParam = parameters.getRawParameterValue("storageFormat");
+    multiCoreParam = parameters.getRawParameterValue("multiCore");
+    freezeParam = parameters.getRawParameterValue("freeze");
+    saveLoopParam = parameters.getRawParameterValue("saveLoop");
+    exportLoopParam = parameters.getRawParameterValue("exportLoop");
+    exportModeParam = parameters.getRawParameterValue("exportMode");
+    oversamplingParam = parameters.getRawParameterValue("oversampling");
+    delayNetworkParam = parameters.getRawParameterValue("delayNetwork");
+    multirateParam = parameters.getRawParameterValue("multirate");
+
+    for (auto* param : getParameters())                 // Any parameter change bumps parameterVersion, so static blocks can skip the parameter work
+        if (auto* paramWithID = dynamic_cast<juce::AudioProcessorParameterWithID*>(param))
+            parameters.addParameterListener(paramWithID->paramID, this);
+
+    modulation.addModulator([](void* context) { return static_cast<AudioProg_assignment3AudioProcessor*>(context)->tickDelayTimes(); }, this);    // Delay times first, then the filters they feed
+    modulation.addModulator([](void* context) { return static_cast<AudioProg_assignment3AudioProcessor*>(context)->tickFilter(); }, this);
+
+    startTimerHz(4);                                    // Watches for settings that need the delay buffers reallocated
 }
 
 AudioProg_assignment3AudioProcessor::~AudioProg_assignment3AudioProcessor()
 {
+    stopTimer();
+    backgroundJobs.removeAllJobs(true, 10000);
+    multiDelay.setWorkerPool(nullptr);                  // Waits for any of its jobs still running on the shared workers
 }
 
 
 //==============================================================================
 void AudioProg_assignment3AudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
-    for (int i = 0; i < 2; i++)
-        vec[i].delaySetup(sampleRate);                  // Set sample rate for both instances of multiDelay 
+    preparedSampleRate = sampleRate;
+    preparedBlockSize = samplesPerBlock;
+    preparedNumChannels = juce::jlimit(1, Delays::maxChannels, getTotalNumOutputChannels());
+    setupDelays();
+    setupOverdrive();
+
+    delayInBuffer.setSize(preparedNumChannels, samplesPerBlock);    // Scratch buffers for the block based delay path
+    wetBuffer.setSize(preparedNumChannels, samplesPerBlock);
     
-    // Sets the sample Rate and RampLengthInSeconds
-    smoother.reset(sampleRate, 0.000005);       
+    // Sets the control rate and RampLengthInSeconds, the smoothers step once per control tick
+    modulation.setControlInterval(controlInterval);
+    modulation.reset();
+
+    smoother.reset(sampleRate / controlInterval, 0.000005);       
     smoother.setCurrentAndTargetValue(0);
 
-    smootherQ.reset(sampleRate, 0.005);
+    smootherQ.reset(sampleRate / controlInterval, 0.005);
     smootherQ.setCurrentAndTargetValue(0);    
+
+    snapshotVersion = parameterVersion.load() - 1;      // Forces a fresh snapshot on the first block
+    delayValuesDirty = true;
+}
+
+
+/**
+    Allocates the delay buffers for the prepared sample rate, the chosen storage format and multirate storage.
+    Never called from the audio thread.
+*/
+void AudioProg_assignment3AudioProcessor::setupDelays()
+{
+    const juce::ScopedLock lock(delayStateLock);                                        // Waits for a loop save or restore to finish
+    const float maxDelayLength = parameters.getParameterRange("delayLength").end;       // Buffers are sized for the longest delay the parameter can reach
+    appliedStorageFormat = StorageFormat(int(*storageFormatParam));
+    appliedMultirate = multirateWanted();
+
+    multiDelay.delaySetup(preparedSampleRate, preparedBlockSize, maxDelayLength, preparedNumChannels, appliedStorageFormat, appliedMultirate);    // One linked MultiDelay for every channel
+    setupWorkerPool();
+
+    if (pendingLoopState.getSize() > 0)                                                 // A session loaded before the buffers existed
+        startLoopRestore();
+}
+
+
+/**
+    Sets the overdrive's oversampling to match the Drive Oversampling parameter, and reports the latency it adds.
+    Never called from the audio thread, and only while processing is suspended or not yet started.
+*/
+void AudioProg_assignment3AudioProcessor::setupOverdrive()
+{
+    appliedOversampling = int(*oversamplingParam);
+    od1.prepare(preparedBlockSize, preparedNumChannels, appliedOversampling);
+    setLatencySamples(od1.getLatencyInSamples());
+}
+
+
+/**
+    Sets the delay buffers up again for a new storage format or rate, keeping the loop: it is copied
+    out while the audio thread plays on, and put back into the new buffers, resampled where a buffer's
+    rate changed, see MultiDelay::restoreLoop(). A session loop still waiting to be restored is left to
+    setupDelays() instead. Never called from the audio thread.
+*/
+void AudioProg_assignment3AudioProcessor::reallocateDelays()
+{
+    const juce::ScopedLock lock(delayStateLock);                                        // Held throughout, so a session loaded meanwhile is restored after the carried loop
+    const bool carryLoop = pendingLoopState.getSize() == 0;
+
+    Delays::SavedLoop loop;
+    if (carryLoop)
+        multiDelay.captureLoop(loop);
+
+    suspendProcessing(true);
+    setupDelays();
+    suspendProcessing(false);
+
+    if (carryLoop)
+    {
+        const juce::SpinLock::ScopedLockType delayLock(delayAccessLock);               // processBlock() leaves the delays muted meanwhile
+        multiDelay.restoreLoop(loop);
+    }
+}
+
+
+/**
+    Hands the pending loop to the background thread, once the delay buffers exist.
+*/
+void AudioProg_assignment3AudioProcessor::startLoopRestore()
+{
+    if (preparedSampleRate > 0.0)
+        backgroundJobs.addJob([this] { restoreLoopState(); });
+}
+
+
+/**
+    Decodes the pending loop and puts it into the delay buffers. Runs on the background thread, and only
+    holds delayAccessLock for the final copy into the buffers; processBlock() leaves the delays muted
+    meanwhile, and plays the restored loop from the next block on.
+*/
+void AudioProg_assignment3AudioProcessor::restoreLoopState()
+{
+    const juce::ScopedLock lock(delayStateLock);
+    if (pendingLoopState.getSize() == 0 || preparedSampleRate <= 0.0)
+        return;
+
+    Delays::SavedLoop loop;
+    bool decoded;
+    {
+        juce::MemoryInputStream compressed(pendingLoopState, false);
+        juce::GZIPDecompressorInputStream stream(compressed);
+        decoded = multiDelay.decodeLoopState(stream, loop);                             // The audio thread keeps running the delays meanwhile
+    }
+
+    if (decoded)
+    {
+        const juce::SpinLock::ScopedLockType delayLock(delayAccessLock);
+        multiDelay.restoreLoop(loop);
+    }
+
+    pendingLoopState.reset();
+}
+
+
+/**
+    Hands the delay buffers to the shared worker threads, or takes them back, to match the Multi-core Delays parameter.
+    Never called from the audio thread, and only while processing is suspended or not yet started.
+*/
+void AudioProg_assignment3AudioProcessor::setupWorkerPool()
+{
+    appliedMultiCore = *multiCoreParam > 0.5f;
+    auto& pool = sharedWorkers->pool;
+
+    multiDelay.setWorkerPool(appliedMultiCore && pool.getNumWorkers() > 0 ? &pool : nullptr);
+}
+
+
+/**
+    Reallocates the delay buffers when the storage format changes while playing,
+    starts or stops the worker threads when Multi-core Delays is switched,
+    and rebuilds the overdrive's oversampling when Drive Oversampling changes.
+    suspendProcessing() waits for the current block, so the audio thread never sees a half built buffer.
+    Also starts a loop export when Export Loop is switched on, and switches it back off once the export
+    is queued. Until the buffers are prepared the switch just stays on.
+*/
+void AudioProg_assignment3AudioProcessor::timerCallback()
+{
+    if (preparedSampleRate <= 0.0)
+        return;
+
+    if (*exportLoopParam > 0.5f)
+    {
+        const int choice = int(*exportModeParam);                                       // Mix WAV, Mix FLAC, Lines WAV, Lines FLAC
+        auto folder = juce::File::getSpecialLocation(juce::File::userMusicDirectory).getChildFile("AudioProg Loops");
+        folder.createDirectory();
+        exportLoop(folder.getNonexistentChildFile("Loop", choice % 2 == 0 ? ".wav" : ".flac"), choice < 2 ? LoopExportMode::mix : LoopExportMode::lines);    // Queued behind any loop restore on backgroundJobs
+        parameters.getParameter("exportLoop")->setValueNotifyingHost(0.0f);
+    }
+
+    if (StorageFormat(int(*storageFormatParam)) != appliedStorageFormat || multirateWanted() != appliedMultirate)
+    {
+        reallocateDelays();
+    }
+    else if ((*multiCoreParam > 0.5f) != appliedMultiCore)
+    {
+        suspendProcessing(true);
+        setupWorkerPool();
+        suspendProcessing(false);
+    }
+    else if (int(*oversamplingParam) != appliedOversampling)
+    {
+        suspendProcessing(true);
+        setupOverdrive();
+        suspendProcessing(false);
+    }
+}
+
+
+/**
+    Whether the delay buffers should run at decimated rates: only with the Bass filter type, as the
+    other bands reach too close to the host Nyquist. Changing the filter type with Multirate Bass Delays
+    on therefore sets the buffers up again, see reallocateDelays(). Until then MultiDelay holds its
+    decimated buffers silent, see MultiDelay::lineBypassed().
+*/
+bool AudioProg_assignment3AudioProcessor::multirateWanted() const
+{
+    return *multirateParam > 0.5f && int(*filterChoiceParam) == 0;
+}
+
+
+// Called on whichever thread changed the parameter, so it only bumps the version.
+void AudioProg_assignment3AudioProcessor::parameterChanged(const juce::String&, float)
+{
+    parameterVersion.fetch_add(1, std::memory_order_release);
+}
+
+
+AudioProg_assignment3AudioProcessor::ParameterSnapshot AudioProg_assignment3AudioProcessor::captureParameters() const
+{
+    ParameterSnapshot snapshot;
+    snapshot.inputGain = *inputGainParam;
+    snapshot.outputGain = *outputGainParam;
+    snapshot.drive = *driveParam;
+    snapshot.delayMix = *delayMixParam;
+    snapshot.delayLength = *delayLengthParam;
+    snapshot.delayFeedback = *delayFeedbackParam;
+    snapshot.filterQ = *filterQVal;
+    snapshot.filterType = int(*filterChoiceParam);
+    snapshot.delayToggle = *delayToggleParam > 0.5f;
+    snapshot.recLoop = *recLoopParam > 0.5f;
+    snapshot.freeze = *freezeParam > 0.5f;
+    snapshot.delayNetwork = FeedbackMatrix(int(*delayNetworkParam));
+    return snapshot;
+}
+
+
+/**
+    Control tick for the delay buffers: steps the Delay Length smoother and hands every buffer its delay time and feedback.
+    While a released freeze thaws, the tail length follows it, and is worked out once more when the thaw ends.
+    Returns false once the smoother has settled, the buffers are up to date and nothing is thawing, so static blocks leave them alone.
+*/
+bool AudioProg_assignment3AudioProcessor::tickDelayTimes()
+{
+    const bool thawing = blockDelaysAvailable && multiDelay.isThawing();
+
+    if (delayValuesDirty || smoother.isSmoothing())
+    {
+        const float delayLength = smoother.getNextValue();
+
+        if (blockDelaysAvailable)
+        {
+            multiDelay.delayAssignValue(delayLength, params.delayFeedback);                                                             // Assigns delay length and feedback for the delayBufferVector, once for all channels
+            tailLengthSeconds.store(multiDelay.getTailLengthSeconds(), std::memory_order_relaxed);                                      // Hosts read it from other threads
+            liveDelayLength.store(delayLength, std::memory_order_relaxed);
+            delayValuesDirty = false;
+        }
+    }
+    else if (thawing || tailFollowsThaw)
+    {
+        tailLengthSeconds.store(multiDelay.getTailLengthSeconds(), std::memory_order_relaxed);
+    }
+
+    tailFollowsThaw = thawing;
+    return delayValuesDirty || smoother.isSmoothing() || thawing;
+}
+
+
+/**
+    Control tick for the filters: steps the Filter Q smoother. MultiDelay ramps the filters to the new Q
+    over the samples up to the next tick.
+    Returns false once the smoother has settled.
+*/
+bool AudioProg_assignment3AudioProcessor::tickFilter()
+{
+    const float qVal = smootherQ.getNextValue();
+
+    if (blockDelaysAvailable)
+        multiDelay.setFilter(params.filterType, qVal);                                                                                  // Filter choice and filter Q up to the next tick
+
+    return smootherQ.isSmoothing();
 }
 
 
 void AudioProg_assignment3AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    RealtimeChecker::ScopedRealtimeSection realtimeSection("processBlock");                                                             // Reports allocations, locks and blocking calls in debug/CI builds
     juce::ScopedNoDenormals noDenormals;
-    smoother.setTargetValue(*delayLengthParam);                                                                                         // Sets target value for delay Length smoother.
-    smootherQ.setTargetValue(*filterQVal);                                                                                              // Set the target value for filter Q smoother.
+    const juce::SpinLock::ScopedTryLockType delayLock(delayAccessLock);                                                                 // Only fails while a saved loop is streamed into the delay buffers
+    const bool delaysAvailable = delayLock.isLocked();
+
+    const auto version = parameterVersion.load(std::memory_order_acquire);
+    if (version != snapshotVersion)                                                                                                     // Only re-read the parameters when one of them moved
+    {
+        const auto previous = params;
+        params = captureParameters();
+        snapshotVersion = version;
+
+        smoother.setTargetValue(params.delayLength);                                                                                    // Sets target value for delay Length smoother.
+        smootherQ.setTargetValue(params.filterQ);                                                                                       // Set the target value for filter Q smoother.
+
+        if (params.delayLength != previous.delayLength || params.delayFeedback != previous.delayFeedback || params.freeze != previous.freeze
+            || params.delayNetwork != previous.delayNetwork || params.filterType != previous.filterType)
+            delayValuesDirty = true;                                                                                                    // Also brings the tail length up to date
+
+        modulation.wake();                                                                                                              // The next control tick picks the new targets up
+    }
+
+    if (delaysAvailable != blockDelaysAvailable)                                                                                        // A restore started or finished, the ticks skipped the buffers meanwhile
+    {
+        blockDelaysAvailable = delaysAvailable;
+        modulation.wake();
+    }
     
     auto totalNumInputChannels = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
@@ -80,33 +392,78 @@ void AudioProg_assignment3AudioProcessor::processBlock(juce::AudioBuffer<float>&
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear(i, 0, buffer.getNumSamples());                                                                                     // Clears the buffers in left and right channels
    
-    for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
-    {
-        const float* inputData = buffer.getReadPointer(channel);                                                                        
-        float* outputData = buffer.getWritePointer(channel);
-
-        vec[channel].clearDelayBuffers(*delayToggleParam);                                                                              // Clears the delay buffer if *delayToggleParam is true
-        for (int sample = 0; sample < buffer.getNumSamples(); ++sample)
-        {           
-            vec[channel].delayAssignValue(smoother.getNextValue(), *delayFeedbackParam);                                                // Assigns delay length and feedback for the delayBufferVector
-            float inputSample = inputData[sample];                                                                                      // stores the sample from the input buffer                                                                                                    // 
-            const auto input = inputSample * *inputGainParam;                                                                           // Applie gain to the input sample
-            const auto softClip = od1.process(input, *driveParam);                                                                      // Applies subtle overdrive to the signal
-            float delayIn = 0.0;                                                                                                        // the input signal bypasses the delay process and allows the user to play over the loop without affecting it. 
-             
-            if (*recLoopParam == true)                                                                                                  // Saves the input audio to be sent to delay buffer 
-                delayIn = softClip;
-
-            const auto delayedSample = vec[channel].delaySumAudioVectors(delayIn, *filterChoiceParam, smootherQ.getNextValue());        // sends the sample into the MultiDelay class for looping, along with filter choice, and filter Q.
-            
-            auto blend = softClip * (1.0 - *delayMixParam) + delayedSample * *delayMixParam;                                            // To controll the mix of delayed signal with input.
-            blend *= *outputGainParam;                                                                                                  // Applies output gain on the output signal
-
-            if (blend > 1)                                                                                                              // Limiter to keep the samples level below 1
-                blend = 1;
-                       
-            outputData[sample] = blend;                                                                                                 // Sends procesed sample to output buffer
-        }        
+    const int numSamples = buffer.getNumSamples();
+    const int numChannels = juce::jmin(buffer.getNumChannels(), wetBuffer.getNumChannels());
+    const int chunkSize = wetBuffer.getNumSamples();
+
+    if (delaysAvailable)
+    {
+        multiDelay.setFreeze(params.freeze);                                                                                            // Stops the buffers writing and loops them, with a crossfade either way
+        multiDelay.setFeedbackMatrix(params.delayNetwork);                                                                              // Runs the buffers as a feedback delay network, or each on its own
+    }
+
+    if (delaysAvailable)
+        multiDelay.clearDelayBuffers(params.delayToggle);                                                                               // Clears the delay buffer when delayToggle is switched on
+
+    for (int start = 0; start < numSamples; start += chunkSize)                                                                         // Hosts may send more samples than prepareToPlay() promised
+    {
+        const int numToDo = juce::jmin(chunkSize, numSamples - start);
+
+        float* channels[Delays::maxChannels];
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            channels[channel] = buffer.getWritePointer(channel, start);
+            juce::FloatVectorOperations::multiply(channels[channel], params.inputGain, numToDo);                                        // Applie gain to the input sample
+        }
+
+        od1.processBlock(channels, numChannels, numToDo, params.drive);                                                                 // Applies subtle overdrive to the signal, every channel at once
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            float* data = channels[channel];
+            float* delayIn = delayInBuffer.getWritePointer(channel);
+
+            if (params.recLoop)                                                                                                  // Saves the input audio to be sent to delay buffer 
+                juce::FloatVectorOperations::copy(delayIn, data, numToDo);
+            else
+                juce::FloatVectorOperations::clear(delayIn, numToDo);                                                                   // the input signal bypasses the delay process and allows the user to play over the loop without affecting it. 
+        }
+
+        for (int channel = numChannels; channel < delayInBuffer.getNumChannels(); ++channel)
+            delayInBuffer.clear(channel, 0, numToDo);                                                                                   // Channels the host didn't send are fed silence
+
+        modulation.process(numToDo, [&](int offset, int length)                                                                         // Delay times and filters move at the control ticks, see tickDelayTimes() and tickFilter()
+        {
+            const float* segmentIn[Delays::maxChannels];
+            float* segmentOut[Delays::maxChannels];
+            for (int channel = 0; channel < delayInBuffer.getNumChannels(); ++channel)
+            {
+                segmentIn[channel] = delayInBuffer.getReadPointer(channel, offset);
+                segmentOut[channel] = wetBuffer.getWritePointer(channel, offset);
+            }
+
+            if (delaysAvailable)
+                multiDelay.processBlock(segmentIn, segmentOut, length);                                                                 // sends every channel into the MultiDelay class for looping, one delay buffer at a time
+            else
+                wetBuffer.clear(offset, length);                                                                                        // The delays are muted while a saved loop is restored
+        });
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            float* data = buffer.getWritePointer(channel, start);
+            const float* wet = wetBuffer.getReadPointer(channel);
+
+            for (int sample = 0; sample < numToDo; ++sample)
+            {
+                auto blend = data[sample] * (1.0 - params.delayMix) + wet[sample] * params.delayMix;                                    // To controll the mix of delayed signal with input.
+                blend *= params.outputGain;                                                                                              // Applies output gain on the output signal
+
+                if (blend > 1)                                                                                                          // Limiter to keep the samples level below 1
+                    blend = 1;
+
+                data[sample] = blend;                                                                                                   // Sends procesed sample to output buffer
+            }
+        }
     }   
 }
 
@@ -144,9 +501,10 @@ bool AudioProg_assignment3AudioProcessor::isMidiEffect() const
    #endif
 }
 
+// Worked out on the audio thread whenever the delay times or feedback change, infinite while a buffer loops forever.
 double AudioProg_assignment3AudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    return tailLengthSeconds.load(std::memory_order_relaxed);
 }
 
 int AudioProg_assignment3AudioProcessor::getNumPrograms()
@@ -190,11 +548,11 @@ bool AudioProg_assignment3AudioProcessor::isBusesLayoutSupported (const BusesLay
     return true;
   #else
     // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
+    // MultiDelay links up to 8 channels, so anything from mono to 7.1 works.
     // Some plugin hosts, such as certain GarageBand versions, will only
     // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    if (layouts.getMainOutputChannelSet().isDisabled()
+     || layouts.getMainOutputChannelSet().size() > Delays::maxChannels)
         return false;
 
     // This checks if the input layout matches the output layout
@@ -210,6 +568,139 @@ bool AudioProg_assignment3AudioProcessor::isBusesLayoutSupported (const BusesLay
 
 
 
+//==============================================================================
+/**
+    Renders the loop built up in the delay buffers to a WAV or FLAC file, picked by the file extension.
+    The buffers are copied without stopping the audio thread, see MultiDelay::copyLine(), and the
+    rendering and writing happen on the background thread, as fast as it can go.
+    @param file: File to write, lines mode adds _line01, _line02 etc. to the name
+    @param mode: Whether to render the mix or each buffer's contents
+    @param onFinished: Called on the background thread with whether the export worked
+    @return false if an export is already running
+*/
+bool AudioProg_assignment3AudioProcessor::exportLoop(const juce::File& file, LoopExportMode mode, std::function<void(bool)> onFinished)
+{
+    if (exportInProgress.exchange(true))
+        return false;
+
+    backgroundJobs.addJob([this, file, mode, onFinished]
+    {
+        const bool exported = renderLoopExport(file, mode);
+        exportInProgress = false;
+
+        if (onFinished != nullptr)
+            onFinished(exported);
+    });
+
+    return true;
+}
+
+
+/**
+    The work behind exportLoop(). The mix is rendered by a second MultiDelay, loaded with a copy of the
+    buffers and set up like the live one, playing one pass of its longest buffer with no input.
+    It takes the delay length the buffers are running at, not the parameter, which the smoother may not have reached yet.
+*/
+bool AudioProg_assignment3AudioProcessor::renderLoopExport(const juce::File& file, LoopExportMode mode)
+{
+    const auto settings = captureParameters();
+    double sampleRate = 0.0;
+    int numChannels = 0;
+    float delayLength = 0.0f;
+    bool multirate = false;
+    juce::MemoryOutputStream snapshot;
+    std::vector<juce::AudioBuffer<float>> lines(size_t(mode == LoopExportMode::lines ? Delays::size : 0));
+
+    {
+        const juce::ScopedLock lock(delayStateLock);                                    // Keeps the buffers from being reallocated during the copy
+        if (preparedSampleRate <= 0.0)
+            return false;
+
+        sampleRate = preparedSampleRate;
+        numChannels = preparedNumChannels;
+        multirate = appliedMultirate;                                                   // The copy has to be read back at the rates it was stored at
+        delayLength = liveDelayLength.load(std::memory_order_relaxed);
+
+        if (mode == LoopExportMode::mix)
+            multiDelay.writeLoopState(snapshot);
+        else
+            for (int i = 0; i < Delays::size; i++)
+                multiDelay.copyLine(i, lines[size_t(i)]);
+    }
+
+    if (mode == LoopExportMode::lines)
+    {
+        bool exported = true;
+        for (int i = 0; i < Delays::size; i++)
+        {
+            auto lineFile = file.getSiblingFile(file.getFileNameWithoutExtension() + "_line" + juce::String(i + 1).paddedLeft('0', 2) + file.getFileExtension());
+            exported = writeAudioFile(lineFile, lines[size_t(i)], sampleRate) && exported;
+        }
+        return exported;
+    }
+
+    if (delayLength <= 0.0f)                                                            // Nothing has been played into the buffers yet
+        return false;
+
+    auto renderDelays = std::make_unique<Delays>();                                     // Only sized for the current delay length, not the longest one
+    renderDelays->delaySetup(float(sampleRate), exportBlockSize, delayLength, numChannels, StorageFormat::float32, multirate);
+    renderDelays->delayAssignValue(delayLength, settings.delayFeedback);
+    renderDelays->setFilter(settings.filterType, settings.filterQ);
+    renderDelays->setFeedbackMatrix(settings.delayNetwork);
+
+    juce::MemoryInputStream input(snapshot.getData(), snapshot.getDataSize(), false);
+    if (! renderDelays->readLoopState(input))
+        return false;
+
+    const int loopLength = renderDelays->getLongestDelayInSamples();
+    if (loopLength <= 0)
+        return false;
+
+    juce::AudioBuffer<float> silence(numChannels, exportBlockSize);
+    juce::AudioBuffer<float> rendered(numChannels, loopLength);
+    silence.clear();
+
+    for (int start = 0; start < loopLength; start += exportBlockSize)
+    {
+        const int numToDo = juce::jmin(exportBlockSize, loopLength - start);
+        float* outputs[Delays::maxChannels];
+        for (int channel = 0; channel < numChannels; channel++)
+            outputs[channel] = rendered.getWritePointer(channel, start);
+
+        renderDelays->setFreeze(settings.freeze);                                       // A frozen loop is rendered as it plays, read-only
+        renderDelays->processBlock(silence.getArrayOfReadPointers(), outputs, numToDo);
+    }
+
+    return writeAudioFile(file, rendered, sampleRate);
+}
+
+
+/**
+    Writes audio as 24 bit WAV or FLAC, whichever the file extension asks for, replacing the file.
+*/
+bool AudioProg_assignment3AudioProcessor::writeAudioFile(const juce::File& file, const juce::AudioBuffer<float>& audio, double sampleRate)
+{
+    juce::AudioFormatManager formats;
+    formats.registerBasicFormats();
+
+    auto* format = formats.findFormatForFileExtension(file.getFileExtension());
+    if (format == nullptr || audio.getNumSamples() == 0)
+        return false;
+
+    file.deleteFile();
+    std::unique_ptr<juce::OutputStream> stream(file.createOutputStream());
+    if (stream == nullptr)
+        return false;
+
+    std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(stream.get(), sampleRate, juce::uint32(audio.getNumChannels()), 24, {}, 0));
+    if (writer == nullptr)
+        return false;
+
+    stream.release();                                                                   // Now owned by the writer
+    return writer->writeFromAudioSampleBuffer(audio, 0, audio.getNumSamples());
+}
+
+
 //==============================================================================
 bool AudioProg_assignment3AudioProcessor::hasEditor() const
 {
@@ -222,28 +713,86 @@ juce::AudioProcessorEditor* AudioProg_assignment3AudioProcessor::createEditor()
 }
 
 //==============================================================================
+/** Switches Export Loop off in a stored parameter state, it is a command rather than a setting. */
+void AudioProg_assignment3AudioProcessor::clearExportCommand(juce::XmlElement& xml)
+{
+    if (auto* exportParam = xml.getChildByAttribute("id", "exportLoop"))
+        exportParam->setAttribute("value", 0.0);
+}
+
 void AudioProg_assignment3AudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    // The parameters are stored as binary XML. With Save Loop In Session on, the delay buffers
+    // follow them as a gzipped binary chunk, see MultiDelay::writeLoopState().
     auto state = parameters.copyState();
     std::unique_ptr<juce::XmlElement> xml(state.createXml());
-    copyXmlToBinary(*xml, destData);
+    clearExportCommand(*xml);
+
+    if (*saveLoopParam < 0.5f)
+    {
+        copyXmlToBinary(*xml, destData);
+        return;
+    }
+
+    juce::MemoryBlock parameterData;
+    copyXmlToBinary(*xml, parameterData);
+
+    juce::MemoryOutputStream stream(destData, false);
+    stream.writeInt(stateMagic);
+    stream.writeInt(int(parameterData.getSize()));
+    stream.write(parameterData.getData(), parameterData.getSize());
+
+    const juce::ScopedLock lock(delayStateLock);
+
+    if (pendingLoopState.getSize() > 0)                                                 // Not restored yet, so pass it on as it came
+    {
+        stream.write(pendingLoopState.getData(), pendingLoopState.getSize());
+    }
+    else if (preparedSampleRate > 0.0)
+    {
+        juce::GZIPCompressorOutputStream compressed(stream);
+        multiDelay.writeLoopState(compressed);                                          // Copies the buffers while the audio thread keeps running
+    }
 }
 
 void AudioProg_assignment3AudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
     // You should use this method to restore your parameters from this memory block,
     // whose contents will have been created by the getStateInformation() call.
-    std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
+    // A loop chunk is handed to the background thread, so the session opens without waiting for it.
+    juce::MemoryInputStream stream(data, size_t(sizeInBytes), false);
+    std::unique_ptr<juce::XmlElement> xmlState;
+    juce::MemoryBlock loopState;
+
+    if (sizeInBytes >= 8 && stream.readInt() == stateMagic)
+    {
+        const int parameterSize = juce::jlimit(0, sizeInBytes - 8, stream.readInt());
+        xmlState = getXmlFromBinary(static_cast<const char*>(data) + 8, parameterSize);
+        loopState.append(static_cast<const char*>(data) + 8 + parameterSize, size_t(sizeInBytes - 8 - parameterSize));
+    }
+    else
+    {
+        xmlState = getXmlFromBinary(data, sizeInBytes);
+    }
+
     if (xmlState.get() != nullptr)
     {
         if (xmlState->hasTagName(parameters.state.getType()))
         {
+            clearExportCommand(*xmlState);                                              // Sessions saved with it on must not export again on every load
             parameters.replaceState(juce::ValueTree::fromXml(*xmlState));
         }
     }
+
+    if (loopState.getSize() > 0)
+    {
+        {
+            const juce::ScopedLock lock(delayStateLock);
+            pendingLoopState.swapWith(loopState);
+        }
+
+        startLoopRestore();
+    }
 }
 
 //==============================================================================
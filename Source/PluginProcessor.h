@@ -11,6 +11,26 @@
 #include <JuceHeader.h>
 #include "DelayLine.h"
 #include "MultiDelay.h"
+#include "RealtimeChecker.h"
+#include "ModulationScheduler.h"
+
+//==============================================================================
+/**
+    Worker threads for the Multi-core Delays mode, one set for every instance of the plugin in the
+    process, so a session full of instances never has more workers than cores to spare.
+    Held through a juce::SharedResourcePointer: the first instance starts the workers, the last one stops them.
+*/
+struct SharedDelayWorkers
+{
+    SharedDelayWorkers()
+    {
+        pool.start(juce::jmin(maxWorkerThreads, juce::SystemStats::getNumCpus() - 1));    // The audio thread is a worker too
+    }
+
+    DelayWorkerPool pool;
+    static constexpr int maxWorkerThreads = 3;          // Keeps the pool small, the delays rarely need more
+};
+
 
 //==============================================================================
 /**
@@ -19,6 +39,8 @@ class AudioProg_assignment3AudioProcessor  : public juce::AudioProcessor
                             #if JucePlugin_Enable_ARA
                              , public juce::AudioProcessorARAExtension
                             #endif
+                             , private juce::Timer
+                             , private juce::AudioProcessorValueTreeState::Listener
 {
 public:
     //==============================================================================
@@ -58,12 +80,65 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
+    //==============================================================================
+    /** What exportLoop() renders. */
+    enum class LoopExportMode
+    {
+        mix,        // One pass round the loop of the summed, filtered output of every delay buffer
+        lines       // What each delay buffer holds, one file per buffer
+    };
+
+    bool exportLoop(const juce::File& file, LoopExportMode mode, std::function<void(bool)> onFinished = {});
+    bool isExportingLoop() const { return exportInProgress.load(); }
+
 private:
 
-    MultiDelay vec[2];                                  // Two instances of MultiDelay, for two left and right channel.
+    /**
+        Every parameter the audio thread uses, read once at the start of a block.
+    */
+    struct ParameterSnapshot
+    {
+        float inputGain = 0.0f;
+        float outputGain = 0.0f;
+        float drive = 0.0f;
+        float delayMix = 0.0f;
+        float delayLength = 0.0f;
+        float delayFeedback = 0.0f;
+        float filterQ = 0.0f;
+        int filterType = 0;
+        bool delayToggle = false;
+        bool recLoop = false;
+        bool freeze = false;
+        FeedbackMatrix delayNetwork = FeedbackMatrix::none;
+    };
+
+    //==============================================================================
+    void setupDelays();
+    void reallocateDelays();
+    void setupWorkerPool();
+    void setupOverdrive();
+    bool multirateWanted() const;
+    void startLoopRestore();
+    void restoreLoopState();
+    static void clearExportCommand(juce::XmlElement& xml);
+    bool renderLoopExport(const juce::File& file, LoopExportMode mode);
+    static bool writeAudioFile(const juce::File& file, const juce::AudioBuffer<float>& audio, double sampleRate);
+    bool tickDelayTimes();
+    bool tickFilter();
+    void timerCallback() override;
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
+    ParameterSnapshot captureParameters() const;
+
+    using Delays = MultiDelay<20>;                      // Number of delay buffers, light and heavy builds only need this changed
+
+    Delays multiDelay;                                  // One MultiDelay shared by every channel, so the control values are worked out once.
     Overdrive od1;                                      // Overdrive instance
-    juce::SmoothedValue<float> smoother;                // Smoother for Delay Length
-    juce::SmoothedValue<float> smootherQ;               // Smoother for Filter Q
+    ModulationScheduler modulation;                     // Steps the smoothers below at control rate, in a fixed order
+    static constexpr int controlInterval = 32;          // Samples between control ticks
+    juce::SmoothedValue<float> smoother;                // Smoother for Delay Length, one step per control tick
+    juce::SmoothedValue<float> smootherQ;               // Smoother for Filter Q, one step per control tick
+    juce::AudioBuffer<float> delayInBuffer;             // Block of samples sent into the delay buffers
+    juce::AudioBuffer<float> wetBuffer;                 // Block of samples returned by the delay buffers
     
     // Initilializing input parameters.
     juce::AudioProcessorValueTreeState parameters;      
@@ -78,6 +153,42 @@ private:
     std::atomic<float>* delayLengthParam;               
     std::atomic<float>* filterChoiceParam;              
     std::atomic<float>* filterQVal;                     
+    std::atomic<float>* storageFormatParam;             
+    std::atomic<float>* multiCoreParam;
+    std::atomic<float>* freezeParam;
+    std::atomic<float>* saveLoopParam;
+    std::atomic<float>* exportLoopParam;
+    std::atomic<float>* exportModeParam;
+    std::atomic<float>* oversamplingParam;
+    std::atomic<float>* delayNetworkParam;
+    std::atomic<float>* multirateParam;
+
+    double preparedSampleRate = 0.0;                    // Sample rate given to prepareToPlay()
+    int preparedBlockSize = 0;                          // Block size given to prepareToPlay()
+    int preparedNumChannels = 2;                        // Channels the delays were set up for
+    StorageFormat appliedStorageFormat = StorageFormat::float32;    // Format the delay buffers are currently stored in
+    bool appliedMultiCore = false;                      // Whether the worker threads are currently running
+    bool appliedMultirate = false;                      // Whether the delay buffers are currently set up at decimated rates
+    int appliedOversampling = 0;                        // Drive Oversampling the overdrive is currently set up for
+
+    juce::SharedResourcePointer<SharedDelayWorkers> sharedWorkers;     // Worker threads for the Multi-core Delays mode, shared with the other instances
+
+    std::atomic<juce::uint32> parameterVersion { 1 };  // Bumped whenever any parameter changes
+    juce::uint32 snapshotVersion = 0;                   // parameterVersion the snapshot was taken at
+    ParameterSnapshot params;                           // Parameter values for the current block
+    bool delayValuesDirty = true;                       // Delay length or feedback moved since delayAssignValue() last ran
+    bool tailFollowsThaw = false;                       // A buffer was thawing at the last delay tick, see tickDelayTimes()
+    bool blockDelaysAvailable = false;                  // processBlock() holds delayAccessLock, so the control ticks may use multiDelay
+    std::atomic<double> tailLengthSeconds { 0.0 };      // Returned by getTailLengthSeconds()
+    std::atomic<float> liveDelayLength { 0.0f };        // Smoothed Delay Length the buffers were last given, for the loop export
+
+    static constexpr int stateMagic = 0x534c5041;       // Starts a state with a loop chunk after the parameters, "APLS"
+    juce::CriticalSection delayStateLock;               // Keeps saving, restoring and reallocating the delay buffers apart, never taken by the audio thread
+    juce::SpinLock delayAccessLock;                     // Held while a loop is streamed into the delay buffers, processBlock() only tries it
+    juce::MemoryBlock pendingLoopState;                 // Compressed loop waiting to be restored, guarded by delayStateLock
+    std::atomic<bool> exportInProgress { false };       // An exportLoop() job is queued or running
+    static constexpr int exportBlockSize = 4096;        // Samples rendered at once by an export
+    juce::ThreadPool backgroundJobs { 1 };              // Runs the loop restore, declared last so it finishes before anything it uses goes
 
 
 
@@ -0,0 +1,390 @@
+/*
+  ==============================================================================
+
+    RealtimeChecker.cpp
+
+    The hooks behind RealtimeChecker.h. Only compiled in with AUDIOPROG_REALTIME_CHECKS=1.
+  ==============================================================================
+*/
+
+#include "RealtimeChecker.h"
+
+#if AUDIOPROG_REALTIME_CHECKS
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if JUCE_LINUX
+ #include <dlfcn.h>
+ #include <fcntl.h>
+ #include <poll.h>
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include <stdarg.h>
+ #include <sys/select.h>
+ #include <time.h>
+ #include <unistd.h>
+#endif
+
+namespace
+{
+    std::atomic<bool> enabled { false };
+    std::atomic<bool> abortOnViolation { false };
+    std::atomic<int> numViolations { 0 };
+
+    thread_local const char* currentSection = nullptr;     // Name of the innermost ScopedRealtimeSection on this thread
+    thread_local int reportDepth = 0;                       // Non zero while this thread is inside the checker, which allocates and locks itself
+
+    std::mutex& getViolationLock()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    std::vector<juce::String>& getViolationList()
+    {
+        static std::vector<juce::String> violations;
+        return violations;
+    }
+
+
+    /** True when a call made right now on this thread should be reported. */
+    bool shouldReport()
+    {
+        return currentSection != nullptr && reportDepth == 0 && enabled.load(std::memory_order_relaxed);
+    }
+
+
+    /**
+        Records a violation with the stack that led to it.
+        @param kind: What went wrong, e.g. "Heap allocation"
+        @param function: The call that was made
+    */
+    void reportViolation(const char* kind, const char* function)
+    {
+        reportDepth++;
+
+        {                                                   // Scoped so the report is freed before checking resumes
+            auto report = juce::String(kind) + " in " + currentSection + ": " + function + "\n"
+                        + juce::SystemStats::getStackBacktrace();
+
+            std::fprintf(stderr, "RealtimeChecker: %s\n", report.toRawUTF8());
+
+            std::lock_guard<std::mutex> lock(getViolationLock());
+            getViolationList().push_back(report);
+        }
+
+        numViolations++;
+
+        if (abortOnViolation.load())
+            std::abort();
+
+        reportDepth--;
+    }
+
+
+    void check(const char* kind, const char* function)
+    {
+        if (shouldReport())
+            reportViolation(kind, function);
+    }
+
+
+    /** Allocates without reporting, for operator new, which reports under its own name. */
+    void* allocateQuietly(std::size_t size)
+    {
+        reportDepth++;
+        void* block = std::malloc(size == 0 ? 1 : size);
+        reportDepth--;
+        return block;
+    }
+
+
+    void freeQuietly(void* block)
+    {
+        reportDepth++;
+        std::free(block);
+        reportDepth--;
+    }
+
+
+   #if JUCE_LINUX
+    /**
+        Looks up the C library's version of a function we replace, once.
+        @param cache: Where the address is kept between calls
+        @param name: Symbol name
+    */
+    template <typename Function>
+    Function nextFunction(std::atomic<void*>& cache, const char* name)
+    {
+        void* function = cache.load(std::memory_order_acquire);
+
+        if (function == nullptr)
+        {
+            reportDepth++;
+            function = dlsym(RTLD_NEXT, name);
+            reportDepth--;
+            cache.store(function, std::memory_order_release);
+        }
+
+        return reinterpret_cast<Function>(function);
+    }
+   #endif
+}
+
+
+namespace RealtimeChecker
+{
+    void setEnabled(bool shouldBeEnabled)           { enabled = shouldBeEnabled; }
+    bool isEnabled()                                { return enabled.load(); }
+    void setAbortOnViolation(bool shouldAbort)      { abortOnViolation = shouldAbort; }
+    int getNumViolations()                          { return numViolations.load(); }
+
+    juce::StringArray getViolations()
+    {
+        reportDepth++;
+        juce::StringArray violations;
+        {
+            std::lock_guard<std::mutex> lock(getViolationLock());
+            for (auto& violation : getViolationList())
+                violations.add(violation);
+        }
+        reportDepth--;
+        return violations;
+    }
+
+    void clearViolations()
+    {
+        reportDepth++;
+        {
+            std::lock_guard<std::mutex> lock(getViolationLock());
+            getViolationList().clear();
+        }
+        numViolations = 0;
+        reportDepth--;
+    }
+
+    ScopedRealtimeSection::ScopedRealtimeSection(const char* sectionName)
+        : previousSection(currentSection)
+    {
+        currentSection = sectionName;
+    }
+
+    ScopedRealtimeSection::~ScopedRealtimeSection()
+    {
+        currentSection = previousSection;
+    }
+}
+
+
+//==============================================================================
+// Replacement operator new and delete, on every platform. The aligned versions are left
+// to the library, which on Linux still ends up in the malloc hooks below.
+
+void* operator new(std::size_t size)
+{
+    check("Heap allocation", "operator new");
+    if (void* block = allocateQuietly(size))
+        return block;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    check("Heap allocation", "operator new[]");
+    if (void* block = allocateQuietly(size))
+        return block;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    check("Heap allocation", "operator new");
+    return allocateQuietly(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    check("Heap allocation", "operator new[]");
+    return allocateQuietly(size);
+}
+
+void operator delete(void* block) noexcept
+{
+    if (block != nullptr)
+        check("Heap free", "operator delete");
+    freeQuietly(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+    if (block != nullptr)
+        check("Heap free", "operator delete[]");
+    freeQuietly(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept                     { operator delete(block); }
+void operator delete[](void* block, std::size_t) noexcept                   { operator delete[](block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept           { operator delete(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept         { operator delete[](block); }
+
+
+#if JUCE_LINUX
+//==============================================================================
+// C library hooks. glibc lets an executable replace malloc and friends, and forward to
+// the __libc_ versions; everything else is forwarded to the next definition through dlsym.
+
+extern "C"
+{
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void __libc_free(void*);
+
+    void* malloc(size_t size)
+    {
+        check("Heap allocation", "malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        check("Heap allocation", "calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* block, size_t size)
+    {
+        check("Heap allocation", "realloc");
+        return __libc_realloc(block, size);
+    }
+
+    void free(void* block)
+    {
+        if (block != nullptr)
+            check("Heap free", "free");
+        __libc_free(block);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Lock", "pthread_mutex_lock");
+        return nextFunction<int (*)(pthread_mutex_t*)>(next, "pthread_mutex_lock")(mutex);
+    }
+
+    int pthread_rwlock_rdlock(pthread_rwlock_t* lock)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Lock", "pthread_rwlock_rdlock");
+        return nextFunction<int (*)(pthread_rwlock_t*)>(next, "pthread_rwlock_rdlock")(lock);
+    }
+
+    int pthread_rwlock_wrlock(pthread_rwlock_t* lock)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Lock", "pthread_rwlock_wrlock");
+        return nextFunction<int (*)(pthread_rwlock_t*)>(next, "pthread_rwlock_wrlock")(lock);
+    }
+
+    int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Lock", "pthread_cond_wait");
+        return nextFunction<int (*)(pthread_cond_t*, pthread_mutex_t*)>(next, "pthread_cond_wait")(condition, mutex);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Lock", "pthread_cond_timedwait");
+        return nextFunction<int (*)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*)>(next, "pthread_cond_timedwait")(condition, mutex, time);
+    }
+
+    int sem_wait(sem_t* semaphore)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Lock", "sem_wait");
+        return nextFunction<int (*)(sem_t*)>(next, "sem_wait")(semaphore);
+    }
+
+    int nanosleep(const struct timespec* duration, struct timespec* remaining)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "nanosleep");
+        return nextFunction<int (*)(const struct timespec*, struct timespec*)>(next, "nanosleep")(duration, remaining);
+    }
+
+    int usleep(useconds_t microseconds)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "usleep");
+        return nextFunction<int (*)(useconds_t)>(next, "usleep")(microseconds);
+    }
+
+    unsigned int sleep(unsigned int seconds)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "sleep");
+        return nextFunction<unsigned int (*)(unsigned int)>(next, "sleep")(seconds);
+    }
+
+    int open(const char* path, int flags, ...)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "open");
+
+        mode_t mode = 0;
+        if ((flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE)
+        {
+            va_list args;
+            va_start(args, flags);
+            mode = mode_t(va_arg(args, int));
+            va_end(args);
+        }
+
+        return nextFunction<int (*)(const char*, int, ...)>(next, "open")(path, flags, mode);
+    }
+
+    ssize_t read(int file, void* buffer, size_t count)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "read");
+        return nextFunction<ssize_t (*)(int, void*, size_t)>(next, "read")(file, buffer, count);
+    }
+
+    ssize_t write(int file, const void* buffer, size_t count)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "write");
+        return nextFunction<ssize_t (*)(int, const void*, size_t)>(next, "write")(file, buffer, count);
+    }
+
+    int fsync(int file)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "fsync");
+        return nextFunction<int (*)(int)>(next, "fsync")(file);
+    }
+
+    int poll(struct pollfd* files, nfds_t numFiles, int timeout)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "poll");
+        return nextFunction<int (*)(struct pollfd*, nfds_t, int)>(next, "poll")(files, numFiles, timeout);
+    }
+
+    int select(int numFiles, fd_set* readFiles, fd_set* writeFiles, fd_set* errorFiles, struct timeval* timeout)
+    {
+        static std::atomic<void*> next { nullptr };
+        check("Blocking system call", "select");
+        return nextFunction<int (*)(int, fd_set*, fd_set*, fd_set*, struct timeval*)>(next, "select")(numFiles, readFiles, writeFiles, errorFiles, timeout);
+    }
+}
+#endif // JUCE_LINUX
+
+#endif // AUDIOPROG_REALTIME_CHECKS
@@ -0,0 +1,88 @@
+/*
+  ==============================================================================
+
+    RealtimeChecker.h
+
+    Debug and CI check that the audio thread stays real-time safe.
+    Build with AUDIOPROG_REALTIME_CHECKS=1 to compile the hooks in, then call
+    RealtimeChecker::setEnabled(true). While a ScopedRealtimeSection is alive on
+    a thread, these are reported with a stack trace:
+        heap allocation and free        operator new/delete everywhere, malloc/calloc/realloc/free on Linux
+        lock acquisition                pthread mutex, rwlock, condition variable and semaphore waits (Linux)
+        blocking system calls           sleep, open, read, write, fsync, poll and select (Linux)
+    The Linux hooks interpose the C library, so they see every call when the checker is
+    linked into an executable, as in the headless Benchmark. A plugin loaded by a host
+    only sees the operator new/delete calls it makes itself.
+
+    With AUDIOPROG_REALTIME_CHECKS left at 0 every function here is an empty inline.
+  ==============================================================================
+*/
+
+#ifndef RealtimeChecker_h
+#define RealtimeChecker_h
+
+#include <JuceHeader.h>
+
+#ifndef AUDIOPROG_REALTIME_CHECKS
+ #define AUDIOPROG_REALTIME_CHECKS 0
+#endif
+
+namespace RealtimeChecker
+{
+   #if AUDIOPROG_REALTIME_CHECKS
+
+    /** Turns reporting on or off for every thread. Off by default. */
+    void setEnabled(bool shouldBeEnabled);
+
+    /** True while reporting is on. */
+    bool isEnabled();
+
+    /** When true the process aborts on the first violation, so a debugger stops on it. */
+    void setAbortOnViolation(bool shouldAbort);
+
+    /** Number of violations reported since the last clearViolations(). */
+    int getNumViolations();
+
+    /** Every violation reported since the last clearViolations(), each with its stack trace. */
+    juce::StringArray getViolations();
+
+    /** Forgets the violations reported so far. */
+    void clearViolations();
+
+
+    /**
+        Marks the current thread as real-time for as long as the object lives.
+        Put one at the top of processBlock().
+    */
+    class ScopedRealtimeSection
+    {
+    public:
+        /** @param sectionName: Shown in the reports, must outlive the section */
+        explicit ScopedRealtimeSection(const char* sectionName);
+        ~ScopedRealtimeSection();
+
+    private:
+        const char* previousSection;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedRealtimeSection)
+    };
+
+   #else
+
+    inline void setEnabled(bool) {}
+    inline bool isEnabled() { return false; }
+    inline void setAbortOnViolation(bool) {}
+    inline int getNumViolations() { return 0; }
+    inline juce::StringArray getViolations() { return {}; }
+    inline void clearViolations() {}
+
+    class ScopedRealtimeSection
+    {
+    public:
+        explicit ScopedRealtimeSection(const char*) {}
+    };
+
+   #endif
+}
+
+#endif // !RealtimeChecker_h
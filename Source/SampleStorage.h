@@ -0,0 +1,184 @@
+/*
+  ==============================================================================
+
+    SampleStorage.h
+
+    Formats the delay buffers can store their samples in, and the
+    encode/decode functions used on the write and read paths.
+
+    Noise floor of one encode/decode pass, measured on a -6 dBFS 997 Hz sine
+    at 48 kHz (error RMS relative to full scale):
+        float32         none, the samples are stored as they are
+        float16         -84.5 dBFS, relative error below 2^-11 so it scales with the signal
+        int16 dithered  -84.3 dBFS, flat TPDF dither with 12 dB of headroom above full scale
+    Looping buffers re-encode the signal on every pass, so with a feedback of 1
+    the floor rises by about 3 dB each time the number of passes doubles.
+  ==============================================================================
+*/
+
+#ifndef SampleStorage_h
+#define SampleStorage_h
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#if defined (__F16C__)
+ #include <immintrin.h>
+#endif
+
+/** Sample formats a DelayLine can store its buffer in. */
+enum class StorageFormat
+{
+    float32,        // Full precision, 4 bytes per sample
+    float16,        // IEEE half float, 2 bytes per sample
+    int16           // Dithered 16 bit integer, 2 bytes per sample
+};
+
+
+namespace SampleStorage
+{
+    /** Full scale of the int16 format. Feedback of 1 lets buffers build up past 1.0, so 12 dB of headroom is kept. */
+    constexpr float int16Headroom = 4.0f;
+
+
+    /** Bytes one stored sample takes up. */
+    inline int bytesPerSample(StorageFormat format)
+    {
+        return format == StorageFormat::float32 ? 4 : 2;
+    }
+
+
+    /** Converts a float to IEEE half precision, rounding to nearest even. */
+    inline std::uint16_t floatToHalf(float value)
+    {
+       #if defined (__F16C__)
+        return (std::uint16_t) _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+       #else
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        std::uint32_t sign = (bits >> 16) & 0x8000;
+        std::uint32_t mantissa = bits & 0x007fffff;
+        int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+
+        if (((bits >> 23) & 0xff) == 0xff)                              // Infinity and NaN
+            return std::uint16_t(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+
+        if (exponent >= 0x1f)                                           // Too large, becomes infinity
+            return std::uint16_t(sign | 0x7c00);
+
+        if (exponent <= 0)                                              // Half precision denormal, or zero
+        {
+            if (exponent < -10)
+                return std::uint16_t(sign);
+
+            mantissa |= 0x00800000;
+            int shift = 14 - exponent;
+            std::uint32_t half = mantissa >> shift;
+            std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+            std::uint32_t midpoint = 1u << (shift - 1);
+
+            if (remainder > midpoint || (remainder == midpoint && (half & 1)))
+                half++;
+
+            return std::uint16_t(sign | half);
+        }
+
+        std::uint32_t half = sign | (std::uint32_t(exponent) << 10) | (mantissa >> 13);
+        std::uint32_t remainder = mantissa & 0x1fff;
+
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))  // A carry into the exponent is still the correct result
+            half++;
+
+        return std::uint16_t(half);
+       #endif
+    }
+
+
+    /** Converts an IEEE half precision value back to float. */
+    inline float halfToFloat(std::uint16_t half)
+    {
+       #if defined (__F16C__)
+        return _cvtsh_ss(half);
+       #else
+        std::uint32_t sign = std::uint32_t(half & 0x8000) << 16;
+        std::uint32_t exponent = (half >> 10) & 0x1f;
+        std::uint32_t mantissa = half & 0x3ff;
+        std::uint32_t bits;
+
+        if (exponent == 0)
+        {
+            float value = float(mantissa) * 5.9604644775390625e-8f;    // Denormal: mantissa * 2^-24
+            return sign != 0 ? -value : value;
+        }
+
+        if (exponent == 0x1f)
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        else
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+       #endif
+    }
+
+
+    /**
+        Converts a float to a dithered 16 bit integer, stored in a uint16_t.
+        @param value: Sample to store
+        @param ditherState: Random state of the caller, advanced twice per call
+    */
+    inline std::uint16_t floatToInt16(float value, std::uint32_t& ditherState)
+    {
+        if (value == 0.0f)                                              // Digital silence stays silent instead of turning into dither noise
+            return 0;
+
+        auto nextRandom = [&ditherState]()                              // xorshift32, uniform in [0, 1)
+        {
+            ditherState ^= ditherState << 13;
+            ditherState ^= ditherState >> 17;
+            ditherState ^= ditherState << 5;
+            return float(ditherState >> 8) * 5.9604644775390625e-8f;
+        };
+
+        float dither = nextRandom() - nextRandom();                     // Triangular dither, +-1 LSB
+        float scaled = value * (32767.0f / int16Headroom) + dither;
+        float rounded = std::floor(scaled + 0.5f);
+
+        if (rounded > 32767.0f)
+            rounded = 32767.0f;
+        if (rounded < -32768.0f)
+            rounded = -32768.0f;
+
+        return std::uint16_t(std::int16_t(rounded));
+    }
+
+
+    /** Converts a stored 16 bit integer back to float. */
+    inline float int16ToFloat(std::uint16_t stored)
+    {
+        return float(std::int16_t(stored)) * (int16Headroom / 32767.0f);
+    }
+
+
+    /**
+        Maps the bit pattern of a half float to a signed 16 bit integer that sorts like the value,
+        so samples either side of zero stay close together. Negative zero becomes zero.
+    */
+    inline std::int16_t halfToOrdered(std::uint16_t half)
+    {
+        const int magnitude = half & 0x7fff;
+        return std::int16_t((half & 0x8000) != 0 ? -magnitude : magnitude);
+    }
+
+
+    /** Converts a value from halfToOrdered() back to the half float bit pattern. */
+    inline std::uint16_t orderedToHalf(std::int16_t ordered)
+    {
+        return ordered < 0 ? std::uint16_t(0x8000 | -int(ordered)) : std::uint16_t(ordered);
+    }
+}
+
+#endif // !SampleStorage_h
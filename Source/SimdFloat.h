@@ -0,0 +1,160 @@
+/*
+  ==============================================================================
+
+    SimdFloat.h
+
+    Thin wrapper around the widest float vector the build targets.
+    AVX-512 packs 16 floats, AVX 8, SSE 4, and anything else falls back
+    to a plain float so the same code still compiles on every platform.
+    Define MULTIDELAY_NO_SIMD to force the scalar version.
+  ==============================================================================
+*/
+
+#ifndef SimdFloat_h
+#define SimdFloat_h
+
+#if ! defined (MULTIDELAY_NO_SIMD) && (defined (__AVX512F__) || defined (__AVX__) || defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2))
+ #include <immintrin.h>
+#endif
+
+#if ! defined (MULTIDELAY_NO_SIMD) && defined (__AVX512F__)
+
+struct SimdFloat
+{
+    static constexpr int width = 16;
+    __m512 v;
+
+    static SimdFloat load(const float* p)           { return { _mm512_loadu_ps(p) }; }
+    static SimdFloat broadcast(float x)             { return { _mm512_set1_ps(x) }; }
+    void store(float* p) const                      { _mm512_storeu_ps(p, v); }
+
+    float sum() const
+    {
+        alignas (64) float lanes[width];
+        _mm512_store_ps(lanes, v);
+
+        float total = 0.0f;
+        for (float lane : lanes)
+            total += lane;
+        return total;
+    }
+};
+
+inline SimdFloat operator+ (SimdFloat a, SimdFloat b) { return { _mm512_add_ps(a.v, b.v) }; }
+inline SimdFloat operator- (SimdFloat a, SimdFloat b) { return { _mm512_sub_ps(a.v, b.v) }; }
+inline SimdFloat operator* (SimdFloat a, SimdFloat b) { return { _mm512_mul_ps(a.v, b.v) }; }
+inline SimdFloat operator/ (SimdFloat a, SimdFloat b) { return { _mm512_div_ps(a.v, b.v) }; }
+inline SimdFloat min(SimdFloat a, SimdFloat b)        { return { _mm512_min_ps(a.v, b.v) }; }
+inline SimdFloat max(SimdFloat a, SimdFloat b)        { return { _mm512_max_ps(a.v, b.v) }; }
+inline SimdFloat abs(SimdFloat a)                     { return { _mm512_abs_ps(a.v) }; }
+
+/** Lane by lane, ifGreater where a > b and otherwise elsewhere. */
+inline SimdFloat selectIfGreater(SimdFloat a, SimdFloat b, SimdFloat ifGreater, SimdFloat otherwise)
+{
+    return { _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ), otherwise.v, ifGreater.v) };
+}
+
+#elif ! defined (MULTIDELAY_NO_SIMD) && defined (__AVX__)
+
+struct SimdFloat
+{
+    static constexpr int width = 8;
+    __m256 v;
+
+    static SimdFloat load(const float* p)           { return { _mm256_loadu_ps(p) }; }
+    static SimdFloat broadcast(float x)             { return { _mm256_set1_ps(x) }; }
+    void store(float* p) const                      { _mm256_storeu_ps(p, v); }
+
+    float sum() const
+    {
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        return _mm_cvtss_f32(half);
+    }
+};
+
+inline SimdFloat operator+ (SimdFloat a, SimdFloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline SimdFloat operator- (SimdFloat a, SimdFloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline SimdFloat operator* (SimdFloat a, SimdFloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline SimdFloat operator/ (SimdFloat a, SimdFloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline SimdFloat min(SimdFloat a, SimdFloat b)        { return { _mm256_min_ps(a.v, b.v) }; }
+inline SimdFloat max(SimdFloat a, SimdFloat b)        { return { _mm256_max_ps(a.v, b.v) }; }
+inline SimdFloat abs(SimdFloat a)                     { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+
+/** Lane by lane, ifGreater where a > b and otherwise elsewhere. */
+inline SimdFloat selectIfGreater(SimdFloat a, SimdFloat b, SimdFloat ifGreater, SimdFloat otherwise)
+{
+    return { _mm256_blendv_ps(otherwise.v, ifGreater.v, _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)) };
+}
+
+#elif ! defined (MULTIDELAY_NO_SIMD) && (defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2))
+
+struct SimdFloat
+{
+    static constexpr int width = 4;
+    __m128 v;
+
+    static SimdFloat load(const float* p)           { return { _mm_loadu_ps(p) }; }
+    static SimdFloat broadcast(float x)             { return { _mm_set1_ps(x) }; }
+    void store(float* p) const                      { _mm_storeu_ps(p, v); }
+
+    float sum() const
+    {
+        __m128 half = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        return _mm_cvtss_f32(half);
+    }
+};
+
+inline SimdFloat operator+ (SimdFloat a, SimdFloat b) { return { _mm_add_ps(a.v, b.v) }; }
+inline SimdFloat operator- (SimdFloat a, SimdFloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline SimdFloat operator* (SimdFloat a, SimdFloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline SimdFloat operator/ (SimdFloat a, SimdFloat b) { return { _mm_div_ps(a.v, b.v) }; }
+inline SimdFloat min(SimdFloat a, SimdFloat b)        { return { _mm_min_ps(a.v, b.v) }; }
+inline SimdFloat max(SimdFloat a, SimdFloat b)        { return { _mm_max_ps(a.v, b.v) }; }
+inline SimdFloat abs(SimdFloat a)                     { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+
+/** Lane by lane, ifGreater where a > b and otherwise elsewhere. */
+inline SimdFloat selectIfGreater(SimdFloat a, SimdFloat b, SimdFloat ifGreater, SimdFloat otherwise)
+{
+    __m128 mask = _mm_cmpgt_ps(a.v, b.v);
+    return { _mm_or_ps(_mm_and_ps(mask, ifGreater.v), _mm_andnot_ps(mask, otherwise.v)) };
+}
+
+#else
+
+struct SimdFloat
+{
+    static constexpr int width = 1;
+    float v;
+
+    static SimdFloat load(const float* p)           { return { *p }; }
+    static SimdFloat broadcast(float x)             { return { x }; }
+    void store(float* p) const                      { *p = v; }
+    float sum() const                               { return v; }
+};
+
+inline SimdFloat operator+ (SimdFloat a, SimdFloat b) { return { a.v + b.v }; }
+inline SimdFloat operator- (SimdFloat a, SimdFloat b) { return { a.v - b.v }; }
+inline SimdFloat operator* (SimdFloat a, SimdFloat b) { return { a.v * b.v }; }
+inline SimdFloat operator/ (SimdFloat a, SimdFloat b) { return { a.v / b.v }; }
+inline SimdFloat min(SimdFloat a, SimdFloat b)        { return { a.v < b.v ? a.v : b.v }; }
+inline SimdFloat max(SimdFloat a, SimdFloat b)        { return { a.v > b.v ? a.v : b.v }; }
+inline SimdFloat abs(SimdFloat a)                     { return { a.v < 0.0f ? -a.v : a.v }; }
+
+/** Lane by lane, ifGreater where a > b and otherwise elsewhere. */
+inline SimdFloat selectIfGreater(SimdFloat a, SimdFloat b, SimdFloat ifGreater, SimdFloat otherwise)
+{
+    return a.v > b.v ? ifGreater : otherwise;
+}
+
+#endif
+
+/** Rounds a lane count up to a whole number of SimdFloat registers. */
+inline int simdPaddedSize(int numLanes)
+{
+    return (numLanes + SimdFloat::width - 1) / SimdFloat::width * SimdFloat::width;
+}
+
+#endif // !SimdFloat_h